@@ -0,0 +1,289 @@
+/* -------------------------------------------------------------------------- */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+#include <functional>
+#include <algorithm>
+#include <vector>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+/* -------------------------------------------------------------------------- */
+#include "httdiskcache.hh"
+/* -------------------------------------------------------------------------- */
+
+namespace fs = std::filesystem;
+
+/* -------------------------------------------------------------------------- */
+HttDiskCache::HttDiskCache(const std::string& dir, size_t max_bytes, size_t chunk_size) :
+  dir(dir), max_bytes(max_bytes), chunk_size(chunk_size ? chunk_size : DISK_CACHE_CHUNK_SIZE), valid(false), used(0)
+{
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (!fs::is_directory(dir, ec)) {
+    std::cerr << "[diskcache]: unable to use cache directory '" << dir << "'" << std::endl;
+    return;
+  }
+  // account what earlier processes left behind
+  for (auto it = fs::recursive_directory_iterator(dir, ec); !ec && (it != fs::recursive_directory_iterator()); it.increment(ec)) {
+    if (it->is_regular_file(ec) && (it->path().filename() != "meta") && (it->path().extension() != ".tmp")) {
+      used += it->file_size(ec);
+    }
+  }
+  valid = true;
+}
+
+/* -------------------------------------------------------------------------- */
+HttDiskCache*
+HttDiskCache::Default()
+{
+  static HttDiskCache* cache = []() -> HttDiskCache* {
+    const char* d = getenv("HTTPCPP_DISK_CACHE");
+    if (!d || !*d) {
+      return nullptr;
+    }
+    const char* s = getenv("HTTPCPP_DISK_CACHE_SIZE");
+    size_t max_bytes = s ? std::strtoull(s, nullptr, 10) : 1024ull*1024*1024;
+    auto c = new HttDiskCache(d, max_bytes);
+    if (!c->Valid()) {
+      delete c;
+      return nullptr;
+    }
+    return c;
+  }();
+  return cache;
+}
+
+/* -------------------------------------------------------------------------- */
+std::string
+HttDiskCache::ObjectDir(const std::string& url)
+{
+  std::stringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>()(url);
+  return dir + "/" + ss.str();
+}
+
+/* -------------------------------------------------------------------------- */
+std::string
+HttDiskCache::ChunkPath(const std::string& url, size_t index)
+{
+  return ObjectDir(url) + "/" + std::to_string(index);
+}
+
+/* -------------------------------------------------------------------------- */
+bool
+HttDiskCache::ReadMeta(const std::string& url, Validator& v)
+{
+  std::ifstream meta(ObjectDir(url) + "/meta");
+  std::string murl, size;
+  if (!std::getline(meta, murl) || (murl != url)) {
+    // missing, or a hash collision
+    return false;
+  }
+  if (!std::getline(meta, v.etag) || !std::getline(meta, v.last_modified) || !std::getline(meta, size)) {
+    return false;
+  }
+  v.size = std::strtoull(size.c_str(), nullptr, 10);
+  return true;
+}
+
+/* -------------------------------------------------------------------------- */
+bool
+HttDiskCache::GetValidator(const std::string& url, Validator& v)
+{
+  if (!valid) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  return ReadMeta(url, v) && (!v.etag.empty() || !v.last_modified.empty());
+}
+
+/* -------------------------------------------------------------------------- */
+void
+HttDiskCache::SetValidator(const std::string& url, const Validator& v)
+{
+  if (!valid) {
+    return;
+  }
+  Validator old;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (ReadMeta(url, old) && (old.etag == v.etag) && (old.last_modified == v.last_modified) && (old.size == v.size)) {
+      return;
+    }
+  }
+  // the object changed or is new
+  Invalidate(url);
+
+  std::lock_guard<std::mutex> lock(mtx);
+  std::error_code ec;
+  std::string odir = ObjectDir(url);
+  fs::create_directories(odir, ec);
+  std::string tmp = odir + "/meta.XXXXXX.tmp";
+  int fd = ::mkstemps(tmp.data(), 4);
+  if (fd < 0) {
+    return;
+  }
+  ::close(fd);
+  {
+    std::ofstream meta(tmp, std::ios::trunc);
+    meta << url << "\n" << v.etag << "\n" << v.last_modified << "\n" << v.size << "\n";
+    if (!meta) {
+      fs::remove(tmp, ec);
+      return;
+    }
+  }
+  fs::rename(tmp, odir + "/meta", ec);
+}
+
+/* -------------------------------------------------------------------------- */
+ssize_t
+HttDiskCache::ReadChunk(const std::string& url, size_t index, char* buffer, size_t len, off_t offset)
+{
+  if (!valid) {
+    return -1;
+  }
+  std::string path = ChunkPath(url, index);
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = ::pread(fd, buffer + done, len - done, offset + done);
+    if (n < 0) {
+      ::close(fd);
+      return -1;
+    }
+    if (!n) {
+      break;
+    }
+    done += n;
+  }
+  // the modification time orders the eviction
+  ::futimens(fd, nullptr);
+  ::close(fd);
+  return done;
+}
+
+/* -------------------------------------------------------------------------- */
+bool
+HttDiskCache::WriteChunk(const std::string& url, size_t index, const char* data, size_t len)
+{
+  if (!valid || (len > max_bytes)) {
+    return false;
+  }
+  std::string path = ChunkPath(url, index);
+  // concurrent writers of the same chunk each get their own file
+  std::string tmp = path + ".XXXXXX.tmp";
+  int fd = ::mkostemps(tmp.data(), 4, O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  ::fchmod(fd, 0644);
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = ::write(fd, data + done, len - done);
+    if (n <= 0) {
+      ::close(fd);
+      ::unlink(tmp.c_str());
+      return false;
+    }
+    done += n;
+  }
+  ::close(fd);
+  bool evict;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    // an overwritten chunk is only accounted once
+    struct stat old;
+    size_t replaced = ::stat(path.c_str(), &old) ? 0 : old.st_size;
+    // readers only ever see complete chunks
+    if (::rename(tmp.c_str(), path.c_str())) {
+      ::unlink(tmp.c_str());
+      return false;
+    }
+    used -= std::min(used, replaced);
+    used += len;
+    evict = (used > max_bytes);
+  }
+  if (evict) {
+    Evict();
+  }
+  return true;
+}
+
+/* -------------------------------------------------------------------------- */
+bool
+HttDiskCache::Complete(const std::string& url, size_t size)
+{
+  if (!valid || !size) {
+    return false;
+  }
+  size_t nchunks = (size + chunk_size - 1) / chunk_size;
+  for (size_t i = 0; i < nchunks; ++i) {
+    struct stat buf;
+    size_t expected = (i + 1 < nchunks) ? chunk_size : size - i * chunk_size;
+    if (::stat(ChunkPath(url, i).c_str(), &buf) || ((size_t)buf.st_size != expected)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* -------------------------------------------------------------------------- */
+void
+HttDiskCache::Invalidate(const std::string& url)
+{
+  if (!valid) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  std::error_code ec;
+  std::string odir = ObjectDir(url);
+  for (auto it = fs::directory_iterator(odir, ec); !ec && (it != fs::directory_iterator()); it.increment(ec)) {
+    if ((it->path().filename() != "meta") && (it->path().extension() != ".tmp")) {
+      size_t size = it->file_size(ec);
+      used -= std::min(used, size);
+    }
+  }
+  fs::remove_all(odir, ec);
+}
+
+/* -------------------------------------------------------------------------- */
+void
+HttDiskCache::Evict()
+{
+  struct Chunk {
+    fs::path path;
+    fs::file_time_type mtime;
+    size_t size;
+  };
+  std::vector<Chunk> chunks;
+  std::error_code ec;
+  for (auto it = fs::recursive_directory_iterator(dir, ec); !ec && (it != fs::recursive_directory_iterator()); it.increment(ec)) {
+    if (it->is_regular_file(ec) && (it->path().filename() != "meta") && (it->path().extension() != ".tmp")) {
+      chunks.push_back(Chunk{it->path(), it->last_write_time(ec), it->file_size(ec)});
+    }
+  }
+  std::sort(chunks.begin(), chunks.end(), [](const Chunk& a, const Chunk& b) { return a.mtime < b.mtime; });
+
+  // make some room at once instead of evicting on every write
+  std::lock_guard<std::mutex> lock(mtx);
+  size_t total = 0;
+  for (auto& c : chunks) {
+    total += c.size;
+  }
+  used = total;
+  for (auto& c : chunks) {
+    if (used <= max_bytes / 10 * 9) {
+      break;
+    }
+    if (fs::remove(c.path, ec)) {
+      used -= c.size;
+    }
+  }
+}
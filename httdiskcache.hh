@@ -0,0 +1,62 @@
+/* -------------------------------------------------------------------------- */
+#include <string>
+#include <mutex>
+#include <sys/types.h>
+/* -------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------- */
+#pragma once
+
+#define DISK_CACHE_CHUNK_SIZE 1*1024*1024   // objects are cached in chunks of this size
+
+/* -------------------------------------------------------------------------- */
+// Persistent chunk store for remote objects.
+//
+// Every object gets a directory named after the hash of its URL, holding a
+// 'meta' file (URL, ETag, Last-Modified, size) and one file per cached chunk.
+// Chunks are only valid together with the validator they were stored with:
+// recording a different validator drops them. The store is bounded by size,
+// the least recently used chunks are evicted first.
+class HttDiskCache {
+public:
+  struct Validator {
+    std::string etag;
+    std::string last_modified;
+    size_t size = 0;
+  };
+
+  HttDiskCache(const std::string& dir, size_t max_bytes, size_t chunk_size = DISK_CACHE_CHUNK_SIZE);
+
+  // cache configured by HTTPCPP_DISK_CACHE (directory) and HTTPCPP_DISK_CACHE_SIZE (bytes,
+  // default 1 GiB), nullptr if not configured
+  static HttDiskCache* Default();
+
+  bool Valid() const { return valid; }
+  size_t ChunkSize() const { return chunk_size; }
+
+  // validator the cached chunks of 'url' belong to, false if nothing is cached
+  bool GetValidator(const std::string& url, Validator& v);
+  // records the validator of 'url', cached chunks are dropped if it changed
+  void SetValidator(const std::string& url, const Validator& v);
+
+  // reads 'len' bytes at 'offset' inside chunk 'index', -1 if the chunk is not cached
+  ssize_t ReadChunk(const std::string& url, size_t index, char* buffer, size_t len, off_t offset = 0);
+  // stores chunk 'index' (short only for the last chunk of the object)
+  bool WriteChunk(const std::string& url, size_t index, const char* data, size_t len);
+  // true if every chunk of an object of 'size' bytes is cached
+  bool Complete(const std::string& url, size_t size);
+
+  void Invalidate(const std::string& url);
+
+private:
+  std::string ObjectDir(const std::string& url);
+  std::string ChunkPath(const std::string& url, size_t index);
+  bool ReadMeta(const std::string& url, Validator& v);
+  void Evict();
+
+  std::string dir;
+  size_t max_bytes;
+  size_t chunk_size;
+  bool valid;
+  std::mutex mtx;
+  size_t used;     // bytes in chunk files
+};
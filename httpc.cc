@@ -9,15 +9,20 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <thread>
+#include <chrono>
 
 // Function to display usage information
 void display_usage(const std::string& programName) {
-  std::cerr << "Usage: " << programName << " [-d] [-k] [-n] [--auth auth] [--cacert file] command [source] destination\n";
+  std::cerr << "Usage: " << programName << " [-d] [-k] [-n] [-p] [-P streams] [--auth auth] [--cacert file] command [source] destination\n";
   std::cerr << "        - allowed commands: get, put, cp, head, mkdir, delete\n";
   std::cerr << "        - commands 'get', 'put' and 'cp' require a source argument.\n";
+  std::cerr << "        - 'delete' accepts several destinations.\n";
   std::cerr << "                    -k : don't verify server credentials.\n";
   std::cerr << "                    -n : disable progress bar.\n";
   std::cerr << "                    -d : enable debug.\n";
+  std::cerr << "                    -p : mkdir creates missing parents.\n";
+  std::cerr << "            -P streams : download with <streams> parallel range requests.\n";
   std::cerr << "         --cacert file : crt file with full certifcate chain.\n";
   std::cerr << " -H \"header: contents\" : add an extra header to any request.\n";
 }
@@ -26,6 +31,8 @@ int main(int argc, char* argv[]) {
   bool k_flag = false;
   bool n_flag = false;
   bool d_flag = false;
+  bool p_flag = false;
+  size_t streams = 1;
   std::string cacert_file;
   httplib::Headers extra_headers;
   std::string command, source, destination, pair;
@@ -37,11 +44,11 @@ int main(int argc, char* argv[]) {
   };
   int opt;
   int option_index = 0;
-  while ((opt = getopt_long(argc, argv, "nkdc:H:", long_options, &option_index)) != -1) {
+  while ((opt = getopt_long(argc, argv, "nkdpc:H:P:", long_options, &option_index)) != -1) {
     switch (opt) {
     case 'k':
       k_flag = true;
-      setenv("HTTCPP_NO_VERIFY","1", 1);
+      setenv("HTTPCPP_NO_VERIFY","1", 1);
       break;
     case 'n':
       n_flag = true;
@@ -49,9 +56,15 @@ int main(int argc, char* argv[]) {
     case 'd':
       d_flag = true;
       break;
+    case 'p':
+      p_flag = true;
+      break;
+    case 'P':
+      streams = std::strtoul(optarg, nullptr, 10);
+      break;
     case 'c':
       cacert_file = optarg;
-      setenv("HTTCPP_CA_BUNDLE",cacert_file.c_str(), 1);
+      setenv("HTTPCPP_CA_BUNDLE",cacert_file.c_str(), 1);
       break;
     case 'H':
       pair = optarg;
@@ -149,7 +162,7 @@ int main(int argc, char* argv[]) {
 	  // single range request
 	  auto buffer_size = ranges[0].second+1-ranges[0].first;
 	  std::vector<char> buffer(buffer_size);
-	  auto r = file->Read(&buffer[0], ranges[0].first, ranges[0].second-ranges[0].first);
+	  auto r = file->Read(&buffer[0], ranges[0].first, buffer_size);
 	  if (r<0) {
 	    const httplib::Result& result = file->Result();
 	    if (result.error() != httplib::Error::Success) {
@@ -184,7 +197,11 @@ int main(int argc, char* argv[]) {
 	  auto r = file->ReadV(ranges, &buffer[0]);
 	  if (r<0) {
 	    const httplib::Result& result = file->Result();
-	    std::cerr << "error: failed to read requested ranges from '" << source << "' " << result.value().status << " : [ " << httplib::status_message(result.value().status) << " ]" <<std::endl;
+	    if (result.error() != httplib::Error::Success) {
+	      std::cerr << "error: failed to read requested ranges from '" << source << "' " << result.error() << " : [ " << httplib::to_string(result.error()) << " ]" <<std::endl;
+	    } else {
+	      std::cerr << "error: failed to read requested ranges from '" << source << "' " << result.value().status << " : [ " << httplib::status_message(result.value().status) << " ]" <<std::endl;
+	    }
 	    return 1;
 	  }
 	  file->Close();
@@ -195,12 +212,17 @@ int main(int argc, char* argv[]) {
 	httprogress progress(geturi.get_host(), geturi.get_basename());
 	if (!n_flag) {progress.start();}
 	std::unique_ptr<HttPosixFileStreamer> streamer(new HttPosixFileStreamer);
+	streamer->SetParallel(streams);
 	int fd = streamer->Open(geturi.get_host(), geturi.get_port(), (geturi.get_scheme() == "https"), geturi.get_pathcgi(), request_hd);
+	if (fd < 0) {
+	  std::cerr << "error: unable to get file from '" << source << "' : [ " << strerror(errno) << " ]" << std::endl;
+	  return 1;
+	}
 	streamer->WaitHeader();
 	
 	size_t total_r=0;
 	size_t total_s=streamer->Size();
-	size_t r=0;
+	int r=0;
 	
 	if (streamer->Response()->status != 200) {
 	  if (streamer->Response()->status < 200) {
@@ -236,6 +258,12 @@ int main(int argc, char* argv[]) {
 	  if (d_flag) {
 	    std::cerr << "[debug] [read] " << r << std::endl;
 	  }
+	  if (r < 0) {
+	    if (!n_flag) {progress.stop();}
+	    std::cerr << "error: transfer of '" << source << "' failed after " << total_r << " bytes : [ " << strerror(errno) << " ]" << std::endl;
+	    ::close(outfd);
+	    return 1;
+	  }
 	  auto w = ::write(outfd, &buffer[0], r);
 	  if ( r != w ) {
 	    std::cerr << "error: couldn't write all data to target '" << destination << "'" << std::endl;
@@ -254,31 +282,132 @@ int main(int argc, char* argv[]) {
       return 1; // Return error code 1
     }
   } else if ( command == "put" ) {
-    std::cerr << "error: not implemented" << std::endl;
-    return 1;
+    // a server answering before the body is complete closes the socket under our writes
+    signal(SIGPIPE, SIG_IGN);
+    try {
+      uri puturi(destination);
+      std::string path = puturi.get_pathcgi();
+      if (path.empty() || (path[0] != '/')) {
+	path.insert(0, "/");
+      }
+      int infd = (source == "-") ? STDIN_FILENO : ::open(source.c_str(), O_RDONLY);
+      if (infd < 0) {
+	std::cerr << "error: unable to open input file '" << source << "'" << std::endl;
+	return 1;
+      }
+      // regular files are sent with a Content-Length and sendfile, anything else chunked
+      struct stat st;
+      ssize_t total_s = (!::fstat(infd, &st) && S_ISREG(st.st_mode)) ? st.st_size : -1;
+      httprogress progress(puturi.get_host(), puturi.get_basename());
+      if (!n_flag) {progress.start();}
+      HttPosixFileWriter writer;
+      if (total_s >= 0) {
+	// the kernel sends the file, we only watch the progress
+	if (writer.OpenFile(puturi.get_host(), puturi.get_port(), (puturi.get_scheme() == "https"), path, extra_headers, infd)) {
+	  std::cerr << "error: unable to read input file '" << source << "'" << std::endl;
+	  return 1;
+	}
+	while (!writer.Done()) {
+	  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	  if (!n_flag) {
+	    progress.take();
+	    progress.print(writer.Sent(), total_s);
+	  }
+	}
+      } else {
+	writer.Open(puturi.get_host(), puturi.get_port(), (puturi.get_scheme() == "https"), path, extra_headers, total_s);
+	size_t total_w = 0;
+	size_t bs = 1024*1024;
+	std::vector<char> buffer(bs);
+	ssize_t r;
+	while ((r = ::read(infd, &buffer[0], bs)) > 0) {
+	  if (writer.Write(&buffer[0], r) != r) {
+	    // the server answered early, Close tells why
+	    break;
+	  }
+	  total_w += r;
+	  if (!n_flag) {
+	    progress.take();
+	    progress.print(total_w, total_w);
+	  }
+	}
+	if (r < 0) {
+	  // leaving without Close aborts the upload instead of storing a truncated file
+	  std::cerr << "error: couldn't read all data from source '" << source << "'" << std::endl;
+	  return 1;
+	}
+      }
+      int status = writer.Close();
+      if (!n_flag) {progress.stop();}
+      if (infd != STDIN_FILENO) {
+	::close(infd);
+      }
+      if (d_flag && writer.Response()) {
+	std::cerr<< "[debug] header" << std::endl;
+	for (auto i:writer.Response()->headers) {
+	  std::cerr << "[debug]" << i.first << ":" << i.second << std::endl;
+	}
+      }
+      if (status < 0) {
+	std::cerr << "error: unable to put file to '" << destination << "' : [ " << strerror(-status) << " ]" << std::endl;
+	return 1;
+      }
+      if ((status < 200) || (status >= 300)) {
+	std::cerr << "error: unable to put file to '" << destination << "' " << status << " : [ " << httplib::status_message(status) << " ]" << std::endl;
+	return 1;
+      }
+      return 0;
+    } catch (...) {
+      std::cerr << "Invalid uri: " << destination << std::endl;
+      return 1;
+    }
   } else if ( command == "head" ) {
     uri headuri(destination);
     httplib::Headers request_hd = extra_headers;
     httplib::Headers response_hd;
     struct stat buf;
-    auto result = HttPosix::Stat(headuri.get_host(), headuri.get_port(), (headuri.get_scheme() == "https"), headuri.get_pathcgi(), buf, request_hd, response_hd);
+    int status = 0;
+    auto result = HttPosix::Stat(headuri.get_host(), headuri.get_port(), (headuri.get_scheme() == "https"), headuri.get_pathcgi(), buf, request_hd, response_hd, &status);
     if (result != httplib::Error::Success) {
       std::cerr << "error: unable to open file from '" << source << "' " << result << " : [ " << httplib::to_string( result ) << " ]" <<std::endl;
       return 1;
     }
+    std::cerr << std::setw(24) << std::left << "Status" << ": " << status << std::endl;
+    for (auto i:response_hd) {
+      std::cerr << std::setw(24) << std::left << i.first << ": " << i.second  << std::endl;
+    }
     return 0;
   } else if ( command == "cp" ) {
     std::cerr << "error: not implemented" << std::endl;
     return 1;
   } else if ( command == "delete") {
-    std::cerr << "error: not implemented" << std::endl;
-    return 1;
-  } else if ( command == "head") {
-    std::cerr << "error: not implemented" << std::endl;
-    return 1;
+    std::vector<std::string> urls(argv + optind + 1, argv + argc);
+    auto rcs = HttPosix::DeleteMany(urls, extra_headers);
+    int failed = 0;
+    for (size_t i = 0; i < urls.size(); ++i) {
+      if (rcs[i]) {
+	std::cerr << "error: unable to delete '" << urls[i] << "' : [ " << strerror(-rcs[i]) << " ]" << std::endl;
+	failed = 1;
+      }
+    }
+    return failed;
   } else if ( command == "mkdir") {
-    std::cerr << "error: not implemented" << std::endl;
-    return 1;
+    try {
+      uri diruri(destination);
+      std::string path = diruri.get_pathcgi();
+      if (path.empty() || (path[0] != '/')) {
+	path.insert(0, "/");
+      }
+      int rc = HttPosix::Mkdir(diruri.get_host(), diruri.get_port(), (diruri.get_scheme() == "https"), path, p_flag, extra_headers);
+      if (rc) {
+	std::cerr << "error: unable to create '" << destination << "' : [ " << strerror(-rc) << " ]" << std::endl;
+	return 1;
+      }
+    } catch (...) {
+      std::cerr << "Invalid uri: " << destination << std::endl;
+      return 1;
+    }
+    return 0;
   } else {
     std::cerr << "error: not implemented" << std::endl;
     return 1;
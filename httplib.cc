@@ -506,6 +506,32 @@ template <typename T> ssize_t handle_EINTR(T fn) {
   return res;
 }
 
+#ifdef __linux__
+// sendfile(2) has no MSG_NOSIGNAL: block SIGPIPE in this thread for the call
+// and drain the one it raised, so callers need not ignore SIGPIPE themselves.
+template <typename T> ssize_t without_sigpipe(T fn) {
+  sigset_t pipe_set, old_set, pending;
+  sigemptyset(&pipe_set);
+  sigaddset(&pipe_set, SIGPIPE);
+  sigpending(&pending);
+  auto was_pending = sigismember(&pending, SIGPIPE);
+  if (!was_pending) { pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set); }
+
+  auto res = fn();
+  auto err = errno;
+
+  if (!was_pending) {
+    if (res < 0 && err == EPIPE) {
+      struct timespec ts = {0, 0};
+      while (sigtimedwait(&pipe_set, nullptr, &ts) < 0 && errno == EINTR) {}
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+  }
+  errno = err;
+  return res;
+}
+#endif
+
 ssize_t read_socket(socket_t sock, void *ptr, size_t size, int flags) {
   return handle_EINTR([&]() {
     return recv(sock,
@@ -665,6 +691,7 @@ public:
   bool is_writable() const override;
   ssize_t read(char *ptr, size_t size) override;
   ssize_t write(const char *ptr, size_t size) override;
+  ssize_t sendfile(int fd, off_t offset, size_t size) override;
   void get_remote_ip_and_port(std::string &ip, int &port) const override;
   void get_local_ip_and_port(std::string &ip, int &port) const override;
   socket_t socket() const override;
@@ -695,6 +722,7 @@ public:
   bool is_writable() const override;
   ssize_t read(char *ptr, size_t size) override;
   ssize_t write(const char *ptr, size_t size) override;
+  ssize_t sendfile(int fd, off_t offset, size_t size) override;
   void get_remote_ip_and_port(std::string &ip, int &port) const override;
   void get_local_ip_and_port(std::string &ip, int &port) const override;
   socket_t socket() const override;
@@ -1575,18 +1603,26 @@ bool read_headers(Stream &strm, Headers &headers) {
 
 bool read_content_with_length(Stream &strm, uint64_t len,
                                      Progress progress,
-                                     ContentReceiverWithProgress out) {
+                                     ContentReceiverWithProgress out,
+                                     ContentBuffer buffer = nullptr) {
   char buf[CPPHTTPLIB_RECV_BUFSIZ];
 
   uint64_t r = 0;
   while (r < len) {
     auto read_len = static_cast<size_t>(len - r);
-    auto n = strm.read(buf, (std::min)(read_len, CPPHTTPLIB_RECV_BUFSIZ));
+    auto ptr = buf;
+    if (buffer) {
+      ptr = buffer(read_len);
+      if (!ptr || !read_len) { return false; }
+    } else {
+      read_len = (std::min)(read_len, CPPHTTPLIB_RECV_BUFSIZ);
+    }
+    auto n = strm.read(ptr, read_len);
     if (n <= 0) {
-      out(buf, static_cast<size_t>(0), r, len);
+      out(ptr, static_cast<size_t>(0), r, len);
       return false; }
 
-    if (!out(buf, static_cast<size_t>(n), r, len)) { return false; }
+    if (!out(ptr, static_cast<size_t>(n), r, len)) { return false; }
     r += static_cast<uint64_t>(n);
 
     if (progress) {
@@ -1609,17 +1645,24 @@ void skip_content_with_length(Stream &strm, uint64_t len) {
 }
 
 bool read_content_without_length(Stream &strm,
-                                        ContentReceiverWithProgress out) {
+                                        ContentReceiverWithProgress out,
+                                        ContentBuffer buffer = nullptr) {
   char buf[CPPHTTPLIB_RECV_BUFSIZ];
   uint64_t r = 0;
   for (;;) {
-    auto n = strm.read(buf, CPPHTTPLIB_RECV_BUFSIZ);
+    auto read_len = CPPHTTPLIB_RECV_BUFSIZ;
+    auto ptr = buf;
+    if (buffer) {
+      ptr = buffer(read_len);
+      if (!ptr || !read_len) { return false; }
+    }
+    auto n = strm.read(ptr, read_len);
     if (n <= 0) {
       // call with size 0 to indicate end of stream
-      if (!out(buf, static_cast<size_t>(0), r, 0)) { return false; }
+      if (!out(ptr, static_cast<size_t>(0), r, 0)) { return false; }
       return true; }
 
-    if (!out(buf, static_cast<size_t>(n), r, 0)) { return false; }
+    if (!out(ptr, static_cast<size_t>(n), r, 0)) { return false; }
     r += static_cast<uint64_t>(n);
   }
 
@@ -1628,7 +1671,8 @@ bool read_content_without_length(Stream &strm,
 
 template <typename T>
 bool read_content_chunked(Stream &strm, T &x,
-                                 ContentReceiverWithProgress out) {
+                                 ContentReceiverWithProgress out,
+                                 ContentBuffer buffer = nullptr) {
   const auto bufsiz = 16;
   char buf[bufsiz];
 
@@ -1647,7 +1691,7 @@ bool read_content_chunked(Stream &strm, T &x,
 
     if (chunk_len == 0) { break; }
 
-    if (!read_content_with_length(strm, chunk_len, nullptr, out)) {
+    if (!read_content_with_length(strm, chunk_len, nullptr, out, buffer)) {
       return false;
     }
 
@@ -1737,7 +1781,10 @@ bool prepare_content_receiver(T &x, int &status,
 template <typename T>
 bool read_content(Stream &strm, T &x, size_t payload_max_length, int &status,
                   Progress progress, ContentReceiverWithProgress receiver,
-                  bool decompress) {
+                  bool decompress, ContentBuffer buffer = nullptr) {
+  // decoded content can't be received in place
+  if (decompress && x.has_header("Content-Encoding")) { buffer = nullptr; }
+
   return prepare_content_receiver(
       x, status, std::move(receiver), decompress,
       [&](const ContentReceiverWithProgress &out) {
@@ -1745,9 +1792,9 @@ bool read_content(Stream &strm, T &x, size_t payload_max_length, int &status,
         auto exceed_payload_max_length = false;
 
         if (is_chunked_transfer_encoding(x.headers)) {
-          ret = read_content_chunked(strm, x, out);
+          ret = read_content_chunked(strm, x, out, buffer);
         } else if (!has_header(x.headers, "Content-Length")) {
-          ret = read_content_without_length(strm, out);
+          ret = read_content_without_length(strm, out, buffer);
         } else {
           auto len = get_header_value_u64(x.headers, "Content-Length", 0, 0);
           if (len > payload_max_length) {
@@ -1755,7 +1802,8 @@ bool read_content(Stream &strm, T &x, size_t payload_max_length, int &status,
             skip_content_with_length(strm, len);
             ret = false;
           } else if (len > 0) {
-            ret = read_content_with_length(strm, len, std::move(progress), out);
+            ret = read_content_with_length(strm, len, std::move(progress), out,
+                                           buffer);
           }
         }
 
@@ -1791,6 +1839,17 @@ bool write_data(Stream &strm, const char *d, size_t l) {
   return true;
 }
 
+bool write_file(Stream &strm, int fd, off_t offset, size_t l) {
+  while (l) {
+    auto length = strm.sendfile(fd, offset, l);
+    // 0: the file is shorter than announced
+    if (length <= 0) { return false; }
+    offset += length;
+    l -= static_cast<size_t>(length);
+  }
+  return true;
+}
+
 template <typename T>
 bool write_content(Stream &strm, const ContentProvider &content_provider,
                           size_t offset, size_t length, T is_shutting_down,
@@ -1810,6 +1869,17 @@ bool write_content(Stream &strm, const ContentProvider &content_provider,
     return ok;
   };
 
+  data_sink.sendfile = [&](int fd, off_t file_offset, size_t l) -> bool {
+    if (ok) {
+      if (strm.is_writable() && write_file(strm, fd, file_offset, l)) {
+        offset += l;
+      } else {
+        ok = false;
+      }
+    }
+    return ok;
+  };
+
   data_sink.is_writable = [&]() -> bool { return strm.is_writable(); };
 
   while (offset < end_offset && !is_shutting_down()) {
@@ -1856,6 +1926,16 @@ write_content_without_length(Stream &strm,
     return ok;
   };
 
+  data_sink.sendfile = [&](int fd, off_t file_offset, size_t l) -> bool {
+    if (ok) {
+      offset += l;
+      if (!strm.is_writable() || !write_file(strm, fd, file_offset, l)) {
+        ok = false;
+      }
+    }
+    return ok;
+  };
+
   data_sink.is_writable = [&]() -> bool { return strm.is_writable(); };
 
   data_sink.done = [&](void) { data_available = false; };
@@ -3192,6 +3272,46 @@ ssize_t Stream::write(const std::string &s) {
   return write(s.data(), s.size());
 }
 
+ssize_t Stream::sendfile(int fd, off_t offset, size_t size) {
+#ifndef _WIN32
+  std::array<char, CPPHTTPLIB_SENDFILE_BUFSIZ> buf{};
+  auto n = detail::handle_EINTR([&]() {
+    return ::pread(fd, buf.data(), (std::min)(size, buf.size()), offset);
+  });
+  if (n <= 0) { return n; }
+  if (!detail::write_data(*this, buf.data(), static_cast<size_t>(n))) {
+    return -1;
+  }
+  return n;
+#else
+  (void)fd;
+  (void)offset;
+  (void)size;
+  return -1;
+#endif
+}
+
+// DataSink implementation
+bool DataSink::write_file(int fd, off_t offset, size_t len) {
+#ifndef _WIN32
+  std::array<char, CPPHTTPLIB_SENDFILE_BUFSIZ> buf{};
+  while (len) {
+    auto n = detail::handle_EINTR([&]() {
+      return ::pread(fd, buf.data(), (std::min)(len, buf.size()), offset);
+    });
+    if (n <= 0 || !write(buf.data(), static_cast<size_t>(n))) { return false; }
+    offset += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+#else
+  (void)fd;
+  (void)offset;
+  (void)len;
+  return false;
+#endif
+}
+
 namespace detail {
 
 // Socket stream implementation
@@ -3272,6 +3392,23 @@ ssize_t SocketStream::write(const char *ptr, size_t size) {
   return send_socket(sock_, ptr, size, CPPHTTPLIB_SEND_FLAGS);
 }
 
+ssize_t SocketStream::sendfile(int fd, off_t offset, size_t size) {
+#ifdef __linux__
+  if (!is_writable()) { return -1; }
+
+  auto ret = detail::without_sigpipe([&]() {
+    return handle_EINTR([&]() { return ::sendfile(sock_, fd, &offset, size); });
+  });
+  if (ret < 0 && (errno == EINVAL || errno == ENOSYS)) {
+    // The file system doesn't support sendfile, copy the data
+    return Stream::sendfile(fd, offset, size);
+  }
+  return ret;
+#else
+  return Stream::sendfile(fd, offset, size);
+#endif
+}
+
 void SocketStream::get_remote_ip_and_port(std::string &ip,
                                                  int &port) const {
   return detail::get_remote_ip_and_port(sock_, ip, port);
@@ -5236,10 +5373,18 @@ bool ClientImpl::process_request(Stream &strm, Request &req,
       return ret;
     };
 
+    auto buffer = (req.content_receiver && req.content_buffer && !redirect)
+                      ? static_cast<ContentBuffer>([&](size_t &length) {
+                          auto ptr = req.content_buffer(length);
+                          if (!ptr) { error = Error::Canceled; }
+                          return ptr;
+                        })
+                      : nullptr;
+
     int dummy_status;
     if (!detail::read_content(strm, res, (std::numeric_limits<size_t>::max)(),
                               dummy_status, std::move(progress), std::move(out),
-                              decompress_)) {
+                              decompress_, std::move(buffer))) {
       if (error != Error::Canceled) { error = Error::Read; }
       return false;
     }
@@ -5393,6 +5538,25 @@ Result ClientImpl::Get(const std::string &path, const Headers &headers,
   return send_(std::move(req));
 }
 
+Result ClientImpl::Get(const std::string &path, const Headers &headers,
+                              ResponseHandler response_handler,
+                              ContentBuffer content_buffer,
+                              ContentReceiver content_receiver) {
+  Request req;
+  req.method = "GET";
+  req.path = path;
+  req.headers = headers;
+  req.response_handler = std::move(response_handler);
+  req.content_receiver =
+      [content_receiver](const char *data, size_t data_length,
+                         uint64_t /*offset*/, uint64_t /*total_length*/) {
+        return content_receiver(data, data_length);
+      };
+  req.content_buffer = std::move(content_buffer);
+
+  return send_(std::move(req));
+}
+
 Result ClientImpl::Get(const std::string &path, const Params &params,
                               const Headers &headers, Progress progress) {
   if (params.empty()) { return Get(path, headers); }
@@ -5929,6 +6093,11 @@ size_t ClientImpl::is_socket_open() const {
   return socket_.is_open();
 }
 
+bool ClientImpl::is_socket_alive() const {
+  std::lock_guard<std::mutex> guard(socket_mutex_);
+  return socket_.is_open() && detail::is_socket_alive(socket_.sock);
+}
+
 socket_t ClientImpl::socket() const { return socket_.sock; }
 
 void ClientImpl::set_connection_timeout(time_t sec, time_t usec) {
@@ -6263,6 +6432,18 @@ ssize_t SSLSocketStream::write(const char *ptr, size_t size) {
   return -1;
 }
 
+ssize_t SSLSocketStream::sendfile(int fd, off_t offset, size_t size) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(OPENSSL_NO_KTLS)
+  // Only with kernel TLS (SSL_OP_ENABLE_KTLS) the kernel encrypts the file
+  if (BIO_get_ktls_send(SSL_get_wbio(ssl_))) {
+    if (!is_writable()) { return -1; }
+    return detail::without_sigpipe(
+        [&]() -> ssize_t { return SSL_sendfile(ssl_, fd, offset, size, 0); });
+  }
+#endif
+  return Stream::sendfile(fd, offset, size);
+}
+
 void SSLSocketStream::get_remote_ip_and_port(std::string &ip,
                                                     int &port) const {
   detail::get_remote_ip_and_port(sock_, ip, port);
@@ -6279,6 +6460,72 @@ static SSLInit sslinit_;
 
 } // namespace detail
 
+// SSL session cache implementation
+SSLSessionCache::SSLSessionCache(size_t max_entries)
+    : max_entries_(max_entries ? max_entries : 1) {}
+
+SSLSessionCache::~SSLSessionCache() { clear(); }
+
+SSL_SESSION *SSLSessionCache::get(const std::string &key) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = sessions_.find(key);
+  if (it == sessions_.end()) { return nullptr; }
+  it->second.stamp = ++clock_;
+  SSL_SESSION_up_ref(it->second.session);
+  return it->second.session;
+}
+
+void SSLSessionCache::put(const std::string &key, SSL_SESSION *session) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = sessions_.find(key);
+  if (it != sessions_.end()) {
+    SSL_SESSION_free(it->second.session);
+    it->second.session = session;
+    it->second.stamp = ++clock_;
+    return;
+  }
+
+  if (sessions_.size() >= max_entries_) {
+    // evict the least recently used session
+    auto oldest = sessions_.begin();
+    for (auto i = sessions_.begin(); i != sessions_.end(); ++i) {
+      if (i->second.stamp < oldest->second.stamp) { oldest = i; }
+    }
+    SSL_SESSION_free(oldest->second.session);
+    sessions_.erase(oldest);
+  }
+  sessions_.emplace(key, Entry{session, ++clock_});
+}
+
+void SSLSessionCache::remove(const std::string &key) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = sessions_.find(key);
+  if (it != sessions_.end()) {
+    SSL_SESSION_free(it->second.session);
+    sessions_.erase(it);
+  }
+}
+
+void SSLSessionCache::clear() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (auto &s : sessions_) {
+    SSL_SESSION_free(s.second.session);
+  }
+  sessions_.clear();
+}
+
+void SSLSessionCache::count(bool resumed) {
+  if (resumed) {
+    hits_++;
+  } else {
+    misses_++;
+  }
+}
+
+size_t SSLSessionCache::hits() const { return hits_; }
+
+size_t SSLSessionCache::misses() const { return misses_; }
+
 // SSL HTTP server implementation
 SSLServer::SSLServer(const char *cert_path, const char *private_key_path,
                             const char *client_ca_cert_file_path,
@@ -6468,6 +6715,7 @@ void SSLClient::set_ca_cert_store(X509_STORE *ca_cert_store) {
         // Free memory allocated for old cert and use new store `ca_cert_store`
         SSL_CTX_set_cert_store(ctx_, ca_cert_store);
       }
+      has_ca_cert_store_ = true;
     } else {
       X509_STORE_free(ca_cert_store);
     }
@@ -6485,6 +6733,50 @@ long SSLClient::get_openssl_verify_result() const {
 
 SSL_CTX *SSLClient::ssl_context() const { return ctx_; }
 
+void SSLClient::set_ssl_session_cache(
+    std::shared_ptr<SSLSessionCache> cache) {
+  session_cache_ = std::move(cache);
+  if (ctx_ && session_cache_) {
+    // Sessions are handed to the shared cache, TLS 1.3 tickets arrive after
+    // the handshake so they have to be picked up by the callback.
+    SSL_CTX_set_session_cache_mode(
+        ctx_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx_, new_session_callback);
+  }
+}
+
+std::string SSLClient::ssl_session_key() const {
+  // Sessions established without verification, or verified against other
+  // CA certificates, must never resume a connection which expects a peer
+  // verified against ours.
+  std::string key = host_ + ":" + std::to_string(port_) + "|" + host_ +
+                    (server_certificate_verification_ ? "" : "|noverify") +
+                    "|" + ca_cert_file_path_ + "|" + ca_cert_dir_path_;
+  if (has_ca_cert_store_ && ctx_) {
+    std::ostringstream store;
+    store << "|" << static_cast<const void *>(SSL_CTX_get_cert_store(ctx_));
+    key += store.str();
+  }
+  return key;
+}
+
+int SSLClient::ssl_ex_data_index() {
+  static int index =
+      SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+  return index;
+}
+
+int SSLClient::new_session_callback(SSL *ssl, SSL_SESSION *session) {
+  auto cli =
+      static_cast<SSLClient *>(SSL_get_ex_data(ssl, ssl_ex_data_index()));
+  if (!cli || !cli->session_cache_ || !SSL_SESSION_is_resumable(session)) {
+    return 0;
+  }
+  cli->session_cache_->put(cli->ssl_session_key(), session);
+  // the cache keeps the reference
+  return 1;
+}
+
 bool SSLClient::create_and_connect_socket(Socket &socket, Error &error) {
   return is_valid() && ClientImpl::create_and_connect_socket(socket, error);
 }
@@ -6563,7 +6855,9 @@ bool SSLClient::load_certs() {
 
   std::call_once(initialize_cert_, [&]() {
     std::lock_guard<std::mutex> guard(ctx_mutex_);
-    if (!ca_cert_file_path_.empty()) {
+    if (has_ca_cert_store_) {
+      // the store may be shared with other contexts, use it as it is
+    } else if (!ca_cert_file_path_.empty()) {
       if (!SSL_CTX_load_verify_locations(ctx_, ca_cert_file_path_.c_str(),
                                          nullptr)) {
         ret = false;
@@ -6591,6 +6885,7 @@ bool SSLClient::load_certs() {
 }
 
 bool SSLClient::initialize_ssl(Socket &socket, Error &error) {
+  auto offered_session = false;
   auto ssl = detail::ssl_new(
       socket.sock, ctx_, ctx_mutex_,
       [&](SSL *ssl2) {
@@ -6605,10 +6900,18 @@ bool SSLClient::initialize_ssl(Socket &socket, Error &error) {
         if (!detail::ssl_connect_or_accept_nonblocking(
                 socket.sock, ssl2, SSL_connect, connection_timeout_sec_,
                 connection_timeout_usec_)) {
+          if (offered_session) {
+            // don't offer a session the server chokes on again
+            session_cache_->remove(ssl_session_key());
+          }
           error = Error::SSLConnection;
           return false;
         }
 
+        if (session_cache_) {
+          session_cache_->count(SSL_session_reused(ssl2) == 1);
+        }
+
         if (server_certificate_verification_) {
           verify_result_ = SSL_get_verify_result(ssl2);
 
@@ -6642,6 +6945,15 @@ bool SSLClient::initialize_ssl(Socket &socket, Error &error) {
         // SSL_set_tlsext_host_name(ssl2, host_.c_str());
         SSL_ctrl(ssl2, SSL_CTRL_SET_TLSEXT_HOSTNAME, TLSEXT_NAMETYPE_host_name,
                  static_cast<void *>(const_cast<char *>(host_.c_str())));
+
+        if (session_cache_) {
+          SSL_set_ex_data(ssl2, ssl_ex_data_index(), this);
+          auto session = session_cache_->get(ssl_session_key());
+          if (session) {
+            offered_session = SSL_set_session(ssl2, session) == 1;
+            SSL_SESSION_free(session);
+          }
+        }
         return true;
       });
 
@@ -6928,6 +7240,13 @@ Result Client::Get(const std::string &path, const Headers &headers,
   return cli_->Get(path, headers, std::move(response_handler),
                    std::move(content_receiver), std::move(progress));
 }
+Result Client::Get(const std::string &path, const Headers &headers,
+                          ResponseHandler response_handler,
+                          ContentBuffer content_buffer,
+                          ContentReceiver content_receiver) {
+  return cli_->Get(path, headers, std::move(response_handler),
+                   std::move(content_buffer), std::move(content_receiver));
+}
 Result Client::Get(const std::string &path, const Params &params,
                           const Headers &headers, Progress progress) {
   return cli_->Get(path, params, headers, std::move(progress));
@@ -7253,6 +7572,8 @@ int Client::port() const { return cli_->port(); }
 
 size_t Client::is_socket_open() const { return cli_->is_socket_open(); }
 
+bool Client::is_socket_alive() const { return cli_->is_socket_alive(); }
+
 socket_t Client::socket() const { return cli_->socket(); }
 
 void
@@ -7376,6 +7697,12 @@ SSL_CTX *Client::ssl_context() const {
   if (is_ssl_) { return static_cast<SSLClient &>(*cli_).ssl_context(); }
   return nullptr;
 }
+
+void Client::set_ssl_session_cache(std::shared_ptr<SSLSessionCache> cache) {
+  if (is_ssl_) {
+    static_cast<SSLClient &>(*cli_).set_ssl_session_cache(std::move(cache));
+  }
+}
 #endif
 
 } // namespace httplib
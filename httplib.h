@@ -98,6 +98,10 @@
 #define CPPHTTPLIB_COMPRESSION_BUFSIZ size_t(1048576u)
 #endif
 
+#ifndef CPPHTTPLIB_SENDFILE_BUFSIZ
+#define CPPHTTPLIB_SENDFILE_BUFSIZ size_t(65536u)
+#endif
+
 #ifndef CPPHTTPLIB_THREAD_POOL_COUNT
 #define CPPHTTPLIB_THREAD_POOL_COUNT                                           \
   ((std::max)(8u, std::thread::hardware_concurrency() > 0                      \
@@ -195,6 +199,9 @@ using socket_t = SOCKET;
 #include <pthread.h>
 #include <sys/mman.h>
 #include <sys/select.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -448,7 +455,11 @@ using MultipartFormDataMap = std::multimap<std::string, MultipartFormData>;
 
 class DataSink {
 public:
-  DataSink() : os(&sb_), sb_(*this) {}
+  DataSink() : os(&sb_), sb_(*this) {
+    sendfile = [this](int fd, off_t offset, size_t len) {
+      return write_file(fd, offset, len);
+    };
+  }
 
   DataSink(const DataSink &) = delete;
   DataSink &operator=(const DataSink &) = delete;
@@ -459,9 +470,15 @@ public:
   std::function<bool()> is_writable;
   std::function<void()> done;
   std::function<void(const Headers &trailer)> done_with_trailer;
+  // Sends 'len' bytes at 'offset' of the file 'fd'. Fixed length content is
+  // sent with sendfile(2) (SSL_sendfile over kTLS), anything else is read
+  // into a buffer and passed to 'write'.
+  std::function<bool(int fd, off_t offset, size_t len)> sendfile;
   std::ostream os;
 
 private:
+  bool write_file(int fd, off_t offset, size_t len);
+
   class data_sink_streambuf final : public std::streambuf {
   public:
     explicit data_sink_streambuf(DataSink &sink) : sink_(sink) {}
@@ -502,6 +519,12 @@ using ContentReceiverWithProgress =
 using ContentReceiver =
     std::function<bool(const char *data, size_t data_length)>;
 
+// Supplies the memory the body is received into. Called with the number of
+// bytes wanted in 'length', returns a writable span and stores its usable
+// size in 'length' (nullptr cancels). The following ContentReceiver call
+// then points into that span, so no intermediate copy is made.
+using ContentBuffer = std::function<char *(size_t &length)>;
+
 using MultipartContentHeader =
     std::function<bool(const MultipartFormData &file)>;
 
@@ -554,6 +577,7 @@ struct Request {
   // for client
   ResponseHandler response_handler;
   ContentReceiverWithProgress content_receiver;
+  ContentBuffer content_buffer;
   Progress progress;
 #ifdef CPPHTTPLIB_OPENSSL_SUPPORT
   const SSL *ssl = nullptr;
@@ -642,6 +666,9 @@ public:
 
   virtual ssize_t read(char *ptr, size_t size) = 0;
   virtual ssize_t write(const char *ptr, size_t size) = 0;
+  // Writes up to 'size' bytes at 'offset' of the file 'fd', returns the
+  // number of bytes written. Socket streams let the kernel copy the data.
+  virtual ssize_t sendfile(int fd, off_t offset, size_t size);
   virtual void get_remote_ip_and_port(std::string &ip, int &port) const = 0;
   virtual void get_local_ip_and_port(std::string &ip, int &port) const = 0;
   virtual socket_t socket() const = 0;
@@ -1129,6 +1156,9 @@ public:
   Result Get(const std::string &path, const Headers &headers,
              ResponseHandler response_handler, ContentReceiver content_receiver,
              Progress progress);
+  Result Get(const std::string &path, const Headers &headers,
+             ResponseHandler response_handler, ContentBuffer content_buffer,
+             ContentReceiver content_receiver);
 
   Result Get(const std::string &path, const Params &params,
              const Headers &headers, Progress progress = nullptr);
@@ -1287,6 +1317,7 @@ public:
   int port() const;
 
   size_t is_socket_open() const;
+  bool is_socket_alive() const;
   socket_t socket() const;
 
   void set_hostname_addr_map(std::map<std::string, std::string> addr_map);
@@ -1500,6 +1531,10 @@ private:
   virtual bool is_ssl() const;
 };
 
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+class SSLSessionCache;
+#endif
+
 class Client {
 public:
   // Universal interface
@@ -1544,6 +1579,9 @@ public:
              Progress progress);
   Result Get(const std::string &path, ResponseHandler response_handler,
              ContentReceiver content_receiver, Progress progress);
+  Result Get(const std::string &path, const Headers &headers,
+             ResponseHandler response_handler, ContentBuffer content_buffer,
+             ContentReceiver content_receiver);
 
   Result Get(const std::string &path, const Params &params,
              const Headers &headers, Progress progress = nullptr);
@@ -1702,6 +1740,7 @@ public:
   int port() const;
 
   size_t is_socket_open() const;
+  bool is_socket_alive() const;
   socket_t socket() const;
 
   void set_hostname_addr_map(std::map<std::string, std::string> addr_map);
@@ -1772,6 +1811,8 @@ public:
   long get_openssl_verify_result() const;
 
   SSL_CTX *ssl_context() const;
+
+  void set_ssl_session_cache(std::shared_ptr<SSLSessionCache> cache);
 #endif
 
 private:
@@ -1783,6 +1824,43 @@ private:
 };
 
 #ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+// Client side TLS session cache which can be shared by many SSLClient
+// instances. Sessions are keyed by "host:port|SNI" so that a new connection
+// to the same server resumes the previous session instead of performing a
+// full handshake.
+class SSLSessionCache {
+public:
+  explicit SSLSessionCache(size_t max_entries = 1024);
+  ~SSLSessionCache();
+
+  SSLSessionCache(const SSLSessionCache &) = delete;
+  SSLSessionCache &operator=(const SSLSessionCache &) = delete;
+
+  // Returns a new reference to the cached session or nullptr
+  SSL_SESSION *get(const std::string &key);
+  // Takes over the reference to 'session'
+  void put(const std::string &key, SSL_SESSION *session);
+  void remove(const std::string &key);
+  void clear();
+
+  void count(bool resumed);
+  size_t hits() const;
+  size_t misses() const;
+
+private:
+  struct Entry {
+    SSL_SESSION *session;
+    uint64_t stamp;
+  };
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Entry> sessions_;
+  size_t max_entries_;
+  uint64_t clock_ = 0;
+  std::atomic<size_t> hits_{0};
+  std::atomic<size_t> misses_{0};
+};
+
 class SSLServer : public Server {
 public:
   SSLServer(const char *cert_path, const char *private_key_path,
@@ -1835,6 +1913,8 @@ public:
 
   SSL_CTX *ssl_context() const;
 
+  void set_ssl_session_cache(std::shared_ptr<SSLSessionCache> cache);
+
 private:
   bool create_and_connect_socket(Socket &socket, Error &error) override;
   void shutdown_ssl(Socket &socket, bool shutdown_gracefully) override;
@@ -1855,10 +1935,17 @@ private:
   bool verify_host_with_common_name(X509 *server_cert) const;
   bool check_host_name(const char *pattern, size_t pattern_len) const;
 
+  std::string ssl_session_key() const;
+  static int ssl_ex_data_index();
+  static int new_session_callback(SSL *ssl, SSL_SESSION *session);
+
   SSL_CTX *ctx_;
   std::mutex ctx_mutex_;
   std::once_flag initialize_cert_;
 
+  std::shared_ptr<SSLSessionCache> session_cache_;
+  bool has_ca_cert_store_ = false;
+
   std::vector<std::string> host_components_;
 
   long verify_result_ = 0;
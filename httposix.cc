@@ -2,6 +2,8 @@
 #include <iostream>
 #include <unistd.h>
 #include <future>
+#include <algorithm>
+#include <strings.h>
 /* -------------------------------------------------------------------------- */
 #include "httplib.h"
 #include "httposix.hh"
@@ -11,37 +13,170 @@
 #define BUFFER_SIZE 204800
 
 // Define static members
-std::unordered_map<int, std::shared_ptr<RingBuffer>> RingBufferFDManager::ringBuffers;
-std::atomic<int> RingBufferFDManager::fd_counter{100};  // Start FDs from 100 (like Linux)
-std::mutex RingBufferFDManager::mutex;
+RingBufferFDManager::Slot RingBufferFDManager::slots[RING_FD_TABLE_SIZE];
+std::mutex HttPosixClientPool::mtx;
+std::map<std::string, std::vector<HttPosixClientPool::Idle>> HttPosixClientPool::idle;
+time_t HttPosixClientPool::idle_timeout = getenv("HTTPCPP_POOL_IDLE_TIMEOUT") ? atoi(getenv("HTTPCPP_POOL_IDLE_TIMEOUT")) : CLIENT_POOL_IDLE_TIMEOUT;
+std::mutex HttPosixClientPool::ca_mtx;
+X509_STORE* HttPosixClientPool::ca_store = nullptr;
+std::string HttPosixClientPool::ca_path;
+struct timespec HttPosixClientPool::ca_mtime;
+std::mutex HttPosixRedirectCache::mtx;
+std::list<std::string> HttPosixRedirectCache::lru;
+std::unordered_map<std::string, HttPosixRedirectCache::Entry> HttPosixRedirectCache::entries;
+size_t HttPosixRedirectCache::max_entries = REDIRECT_CACHE_SIZE;
+time_t HttPosixRedirectCache::default_ttl = REDIRECT_CACHE_TTL;
+std::mutex HttPosixStatCache::mtx;
+std::list<std::string> HttPosixStatCache::lru;
+std::unordered_map<std::string, HttPosixStatCache::Entry> HttPosixStatCache::entries;
+size_t HttPosixStatCache::max_entries = STAT_CACHE_SIZE;
+time_t HttPosixStatCache::ttl = STAT_CACHE_TTL;
+time_t HttPosixStatCache::negative_ttl = STAT_CACHE_NEGATIVE_TTL;
+size_t HttPosixClientPool::max_per_host = getenv("HTTPCPP_POOL_MAX_PER_HOST") ? atoi(getenv("HTTPCPP_POOL_MAX_PER_HOST")) : CLIENT_POOL_MAX_PER_HOST;
 
+// object size from 'Content-Range: bytes <first>-<last>/<total>' or 'bytes */<total>', 0 if unknown
+static size_t contentRangeTotal(const httplib::Response& resp) {
+  std::string crange = resp.get_header_value("Content-Range");
+  auto slash = crange.rfind('/');
+  if ((slash == std::string::npos) || !crange.compare(slash + 1, std::string::npos, "*")) {
+    return 0;
+  }
+  return std::strtoull(crange.c_str() + slash + 1, nullptr, 10);
+}
+
+// first byte of 'Content-Range: bytes <first>-<last>/<total>', -1 if there is none
+static off_t contentRangeFirst(const httplib::Response& resp) {
+  std::string crange = resp.get_header_value("Content-Range");
+  if (crange.compare(0, 6, "bytes ") || (crange.size() < 7) || !isdigit(crange[6])) {
+    return -1;
+  }
+  return std::strtoll(crange.c_str() + 6, nullptr, 10);
+}
+
+// validator of the object a response belongs to, for the disk cache
+static HttDiskCache::Validator diskValidator(const httplib::Response& resp, size_t size) {
+  HttDiskCache::Validator v;
+  v.etag = resp.get_header_value("ETag");
+  v.last_modified = resp.get_header_value("Last-Modified");
+  v.size = size;
+  return v;
+}
+
+// true if 'resp' comes from a different version of the object than 'v'
+static bool diskStale(const httplib::Response& resp, const HttDiskCache::Validator& v) {
+  if (!v.etag.empty()) {
+    return resp.get_header_value("ETag") != v.etag;
+  }
+  return resp.get_header_value("Last-Modified") != v.last_modified;
+}
+
+// makes 'hd' a conditional request against the cached version
+static void diskConditional(httplib::Headers& hd, const HttDiskCache::Validator& v) {
+  if (!v.etag.empty()) {
+    hd.insert({"If-None-Match", v.etag});
+  } else {
+    hd.insert({"If-Modified-Since", v.last_modified});
+  }
+}
+
+// shared state of a parallel range download: chunk 0 streams straight into the
+// ring, the following chunks are fetched by worker connections into staging
+// buffers and handed to the ring strictly in order
+struct ParallelGet {
+  std::mutex mtx;
+  std::condition_variable cv;
+  size_t nchunks = 0;
+  size_t next_chunk = 1;      // next chunk handed out to a worker
+  size_t write_chunk = 0;     // next chunk to be appended to the ring
+  size_t window = 0;          // max. chunks ahead of write_chunk in flight/staged
+  std::map<size_t, std::vector<char>> staged;
+  bool failed = false;
+  bool stop = false;
+};
+
+/* -------------------------------------------------------------------------- */
 int HttPosixFileStreamer::Open(const std::string host,
 			       int port,
 			       bool ssl,
 			       const std::string path,
-			       const httplib::Headers& header) {
+			       const httplib::Headers& header,
+			       size_t ring_size,
+			       size_t ring_size_max) {
   //  std::cerr << "http(get): " <<  host << ":" << port << " " << path << std::endl;
   request_header = header;
+  this->host = host;
+  this->port = port;
+  this->ssl = ssl;
+  this->path = path;
 
 #ifdef USE_RING_BUFFER
-  ringfd = RingBufferFDManager::create();
-  ft = std::make_unique<std::future<int>>(std::async(std::launch::async, httpGet, host, port, ssl, path, ringfd, this));
+  ringh = RingBufferFDManager::create(ring_size, ring_size_max);
+  ringfd = ringh.fd;
+  if (ringfd < 0) {
+    // no worker will answer, WaitHeader must not block and Response() must not be empty
+    int err = errno;
+    httplib::Response resp;
+    resp.status = (int)httplib::Error::Unknown;
+    setResponse(resp);
+    NotifyHeader();
+    errno = err;
+    return -1;
+  }
+  Start();
   return ringfd;
 #else
   int retc = socketpair(AF_UNIX, SOCK_STREAM, 0, pipefd);
   //  int retc = pipe(pipefd);
   
-  ft = std::make_unique<std::future<int>>(std::async(std::launch::async, httpGet, host, port, ssl, path, pipefd[1], this));
-  return pipefd[1];
+  Start();
+  return pipefd[0];
 #endif
 }    
 
 /* -------------------------------------------------------------------------- */
-int HttPosixFileStreamer::Close() {
+void HttPosixFileStreamer::Start() {
+  cancel = false;
+  error = 0;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    ready = false;
+  }
+#ifdef USE_RING_BUFFER
+  ft = std::make_unique<std::future<int>>(std::async(std::launch::async, httpGet, host, port, ssl, path, ringfd, this));
+#else
+  ft = std::make_unique<std::future<int>>(std::async(std::launch::async, httpGet, host, port, ssl, path, pipefd[1], this));
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
+void HttPosixFileStreamer::Stop() {
+  // abort the transfer: the receivers check 'cancel', EOF wakes a producer blocked on a full ring
+  cancel = true;
 #ifdef USE_RING_BUFFER
+  RingBufferFDManager::set_eof(ringh);
+#endif
+  {
+    // wake a parallel download waiting for its workers or a staged chunk
+    std::lock_guard<std::mutex> lock(mtx);
+    if (pget) {
+      { std::lock_guard<std::mutex> plock(pget->mtx); }
+      pget->cv.notify_all();
+    }
+  }
   ft->wait();
+}
+
+/* -------------------------------------------------------------------------- */
+int HttPosixFileStreamer::Close() {
+  if (!ft) {
+    return 0;
+  }
+#ifdef USE_RING_BUFFER
+  Stop();
+  ft.reset();
   if (ringfd!=-1) {
-    RingBufferFDManager::destroy(ringfd);
+    RingBufferFDManager::destroy(ringh);
+    ringfd = -1;
   }
   return 0;
 #else
@@ -54,73 +189,577 @@ int HttPosixFileStreamer::Close() {
 
 /* -------------------------------------------------------------------------- */
 off_t HttPosixFileStreamer::Seek(off_t newoffset) {
-  // allow only sequentail IO
-  if (offset != newoffset) {
+  if (newoffset == location) {
+    return newoffset;
+  }
+  if ((newoffset < 0) || (size && ((size_t)newoffset > size)) || !ft) {
+    errno = EINVAL;
+    return -1;
+  }
+#ifdef USE_RING_BUFFER
+  {
+    RingBufferFDManager::Pin ring(ringh);
+    if (!ring) {
+      errno = EBADF;
+      return -1;
+    }
+    size_t distance = newoffset - location;
+    if ((newoffset > location) &&
+	(distance <= std::max(ring->readable(), (size_t)STREAM_SEEK_SKIP_SIZE))) {
+      // short forward seek: drop the bytes in between from the ring
+      while (distance) {
+	const char* span;
+	size_t n = ring->peek(span, distance);
+	if (!n) {
+	  break;  // EOF
+	}
+	ring->consume(n);
+	distance -= n;
+	location += n;
+      }
+      if (location == newoffset) {
+	return newoffset;
+      }
+    }
+  }
+  // restart the transfer at the new offset, the ring (and its fd) stay the same
+  Stop();
+  bool at_end = size && ((size_t)newoffset == size);
+  {
+    RingBufferFDManager::Pin ring(ringh);
+    if (!ring) {
+      errno = EBADF;
+      return -1;
+    }
+    ring->reset();
+    if (at_end) {
+      // nothing left to transfer, a request would only get a 416
+      error = 0;
+      ring->set_eof();
+    }
+  }
+  start_offset = newoffset;
+  location = newoffset;
+  if (!at_end) {
+    Start();
+  }
+  return newoffset;
+#else
+  // the socketpair path can only skip forward
+  std::vector<char> scratch(BUFFER_SIZE);
+  while ((newoffset > location) &&
+	 (Read(&scratch[0], std::min((size_t)(newoffset - location), scratch.size())) > 0)) {
+  }
+  if (newoffset != location) {
     errno = EINVAL;
     return -1;
   }
   return newoffset;
+#endif
 }
 
 /* -------------------------------------------------------------------------- */
 int HttPosixFileStreamer::Read(char* buffer, size_t len) {
   size_t total_r=0;
   size_t r=0;
+#ifdef USE_RING_BUFFER
+  RingBufferFDManager::Pin ring(ringh);
+  if (!ring) {
+    return 0;
+  }
+#endif
   do {
     size_t toread = ((len-total_r)>BUFFER_SIZE)? BUFFER_SIZE:(len-total_r);
     //    std::cerr << "[toread] " << toread << std::endl;
 #ifdef USE_RING_BUFFER
-    r = RingBufferFDManager::read(ringfd, buffer+total_r, toread);
+    r = ring->read(buffer+total_r, toread);
 #else
     r = ::read(pipefd[0], buffer+total_r, toread);
 #endif
     //    std::cerr << "[read] " << r << std::endl;
     total_r += (r>0)?r:0;
   } while ( (r>0) && (total_r<len));
+  if (!total_r && error) {
+    // everything received before the transfer failed has been read
+    errno = error;
+    return -1;
+  }
   location += total_r;
   //  std::cerr<< "[info]: read " << total_r << " bytes!" << std::endl;
   return total_r;
 }
 
 /* -------------------------------------------------------------------------- */
-int HttPosixFileStreamer::httpGet(const std::string& host, int port, bool ssl, const std::string& path, int fd, HttPosixFileStreamer* streamer){
+int HttPosixFileStreamer::TryRead(char* buffer, size_t len) {
+#ifdef USE_RING_BUFFER
+  ssize_t r = RingBufferFDManager::try_read(ringh, buffer, len);
+#else
+  ssize_t r = ::recv(pipefd[0], buffer, len, MSG_DONTWAIT);
+#endif
+  if (!r && error) {
+    errno = error;
+    return -1;
+  }
+  if (r > 0) {
+    location += r;
+  }
+  return r;
+}
+
+/* -------------------------------------------------------------------------- */
+// fetch [offset, offset+len) into dst, returns false unless exactly len bytes arrived;
+// gives up as soon as 'cancel' is set
+static bool getRange(httplib::Client& cli, const std::string& path, httplib::Headers hd,
+		     off_t offset, size_t len, char* dst, const std::atomic<bool>& cancel)
+{
+  auto range = hd.equal_range("Range");
+  hd.erase(range.first, range.second);
+  hd.insert(httplib::make_range_header({{offset, offset + len - 1}}));
+
+  size_t off = 0;
+  auto res = cli.Get(
+		     path,
+		     hd,
+		     [&](const httplib::Response &resp) {
+		       return !cancel && (resp.status == httplib::StatusCode::PartialContent_206);
+		     },
+		     [&](size_t& length) -> char* {
+		       length = std::min(length, len - off);
+		       return length ? dst + off : nullptr;
+		     },
+		     [&](const char *data, size_t data_length) {
+		       if (cancel) {
+			 return false;
+		       }
+		       if (data != dst + off) {
+			 if (data_length > len - off) {
+			   return false;
+			 }
+			 memcpy(dst + off, data, data_length);
+		       }
+		       off += data_length;
+		       return true;
+		     });
+  return res && (off == len);
+}
+
+/* -------------------------------------------------------------------------- */
+void HttPosixFileStreamer::SetParallel(size_t streams, size_t chunksize)
+{
+  parallel_streams = streams ? streams : 1;
+  parallel_chunk = chunksize ? chunksize : PARALLEL_CHUNK_SIZE;
+}
+
+/* -------------------------------------------------------------------------- */
+int HttPosixFileStreamer::httpGet(const std::string& host, int port, bool ssl, const std::string& path, [[maybe_unused]] int fd, HttPosixFileStreamer* streamer){
   
-  std::unique_ptr<httplib::Client> cli = HttPosix::Client(host, port, ssl);
+  // redirections are followed here instead of inside httplib, so they can be
+  // served from and added to the redirect cache
+  HttPosixRedirectCache::Target at;
+  at.host = host;
+  at.port = port;
+  at.ssl = ssl;
+  at.path = path;
+  std::string origin = HttPosixRedirectCache::Key(host, port, ssl, path);
+  bool via_cache = false;
+  for (int hop = 0; hop < REDIRECT_MAX_HOPS; ++hop) {
+    HttPosixRedirectCache::Target next;
+    if (!HttPosixRedirectCache::Lookup(HttPosixRedirectCache::Key(at.host, at.port, at.ssl, at.path), next)) {
+      break;
+    }
+    at = next;
+    via_cache = true;
+  }
+  bool redirected = false;
+  char sink[4096];   // receives the body of redirect responses
+  size_t skip = 0;   // bytes to drop of a 200 answering a restart at 'base'
+
+  auto cli = HttPosix::Client(at.host, at.port, at.ssl);
   std::string body;
-  const httplib::Headers& hd = streamer->request_header;
+  httplib::Headers hd = streamer->request_header;
+  off_t base = streamer->start_offset;
+  if (base) {
+    // restarted by Seek
+    auto range = hd.equal_range("Range");
+    hd.erase(range.first, range.second);
+    hd.insert({"Range", std::string("bytes=") + std::to_string(base) + "-"});
+  }
+
+  // a complete copy in the disk cache is streamed from there once the server
+  // confirms it with a 304, otherwise a full download is added to the cache
+#ifdef USE_RING_BUFFER
+  HttDiskCache* disk = streamer->request_header.count("Range") ? nullptr : streamer->disk;
+#else
+  HttDiskCache* disk = nullptr;
+#endif
+  HttDiskCache::Validator cached;
+  bool conditional = disk && disk->GetValidator(origin, cached) && ((size_t)base < cached.size) &&
+    disk->Complete(origin, cached.size);
+  if (conditional) {
+    diskConditional(hd, cached);
+  }
+  bool from_disk = false;
+  bool teeing = false;
+  std::vector<char> tee;   // the chunk being received
+  size_t tee_index = 0;
+
+  // request->header time, used as RTT estimate for the adaptive ring size
+  auto t_request = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point t_header;
+  std::function<void(const httplib::Response&)> startParallel;
+
+  auto on_response = [&](const httplib::Response &resp) {
+    if (0) {
+      std::cerr << "Response: " << resp.status << std::endl;
+    }
+    t_header = std::chrono::steady_clock::now();
+    if (streamer->cancel) {
+      return false;
+    }
+    if ((resp.status > 300) && (resp.status < 400) && resp.has_header("Location")) {
+      HttPosixRedirectCache::Target next;
+      if (HttPosixRedirectCache::Store(HttPosixRedirectCache::Key(at.host, at.port, at.ssl, at.path), at, resp, next)) {
+	at = next;
+	redirected = true;
+	// the new entry goes as well if its target fails
+	via_cache = true;
+	return true;
+      }
+    }
+    if (via_cache && (resp.status >= 400)) {
+      // the cached target went away, resolve again next time
+      HttPosixRedirectCache::Invalidate(origin);
+    }
+    if (conditional && (resp.status == httplib::StatusCode::NotModified_304)) {
+      // answer as the server would have, the body comes from disk
+      httplib::Response ok = resp;
+      ok.headers.erase("Content-Length");
+      ok.set_header("Content-Length", std::to_string(cached.size - base));
+      if (base) {
+	ok.status = httplib::StatusCode::PartialContent_206;
+	ok.set_header("Content-Range", std::string("bytes ") + std::to_string(base) + "-" +
+		      std::to_string(cached.size - 1) + "/" + std::to_string(cached.size));
+      } else {
+	ok.status = httplib::StatusCode::OK_200;
+      }
+      from_disk = true;
+      streamer->setResponse(ok);
+      streamer->NotifyHeader();
+      return true;
+    }
+    if (base) {
+      // a restart by Seek must deliver the body from 'base' on: a server ignoring
+      // the range sends it from 0, anything else can't be handed out as file data
+      if (resp.status == httplib::StatusCode::OK_200) {
+	skip = base;
+      } else if ((resp.status != httplib::StatusCode::PartialContent_206) || (contentRangeFirst(resp) != base)) {
+	streamer->error = ESPIPE;
+	return false;
+      }
+    }
+    streamer->setResponse(resp);
+    // replaying from disk falls back to range requests for evicted chunks: a 200 needs
+    // 'Accept-Ranges: bytes', a 206 proves range support
+    if (disk && !resp.has_header("Content-Encoding") &&
+	(((resp.status == httplib::StatusCode::OK_200) && !base &&
+	  (resp.get_header_value("Accept-Ranges").find("bytes") != std::string::npos)) ||
+	 ((resp.status == httplib::StatusCode::PartialContent_206) && !(base % disk->ChunkSize())))) {
+      HttDiskCache::Validator v = diskValidator(resp, streamer->size);
+      if (v.size && (!v.etag.empty() || !v.last_modified.empty())) {
+	disk->SetValidator(origin, v);
+	teeing = true;
+	tee_index = base / disk->ChunkSize();
+      }
+    }
+    if (startParallel) {
+      startParallel(resp);
+    }
+    streamer->NotifyHeader();
+    //			RingBufferFDManager::set_eof(fd);
+    return true; // return 'false' if you want to cancel the request.
+  };
+
+#ifdef USE_RING_BUFFER
+  // keep the ring pinned for the whole transfer
+  RingBufferFDManager::Pin ring(streamer->ringh);
+  if (!ring) {
+    httplib::Response resp;
+    resp.status = (int)httplib::Error::Unknown;
+    streamer->setResponse(resp);
+    streamer->NotifyHeader();
+    return -1;
+  }
+  char* span = nullptr;
+
+  // parallel mode: once size and range support are known, the first response
+  // delivers chunk 0 and worker connections fetch the following chunks
+  ParallelGet pget;
+  {
+    std::lock_guard<std::mutex> lock(streamer->mtx);
+    streamer->pget = &pget;
+  }
+  std::vector<std::future<void>> workers;
+  size_t limit = (size_t)-1;   // bytes accepted from the first response
+
+  auto worker = [&](std::string whost, int wport, bool wssl, std::string wpath) {
+    auto wcli = HttPosix::Client(whost, wport, wssl);
+    for (;;) {
+      size_t k;
+      {
+	std::unique_lock<std::mutex> lock(pget.mtx);
+	pget.cv.wait(lock, [&] { return pget.stop || pget.failed || streamer->cancel || (pget.next_chunk >= pget.nchunks) ||
+				   (pget.next_chunk < pget.write_chunk + pget.window); });
+	if (pget.stop || pget.failed || streamer->cancel || (pget.next_chunk >= pget.nchunks)) {
+	  return;
+	}
+	k = pget.next_chunk++;
+      }
+      off_t offset = base + k * streamer->parallel_chunk;
+      size_t len = std::min(streamer->parallel_chunk, streamer->size - offset);
+      std::vector<char> chunk(len);
+      bool ok = false;
+      for (int retry = 0; !ok && !streamer->cancel && (retry < 3); ++retry) {
+	ok = getRange(*wcli, wpath, streamer->request_header, offset, len, chunk.data(), streamer->cancel);
+      }
+      {
+	std::lock_guard<std::mutex> lock(pget.mtx);
+	if (ok) {
+	  pget.staged[k] = std::move(chunk);
+	} else {
+	  pget.failed = true;
+	}
+      }
+      pget.cv.notify_all();
+    }
+  };
+
+  startParallel = [&](const httplib::Response& resp) {
+    size_t total = streamer->size - base;
+    // a 206 answer to our own 'bytes=<base>-' proves range support as well
+    bool ranges = base ? (resp.status == httplib::StatusCode::PartialContent_206) :
+      ((resp.status == httplib::StatusCode::OK_200) &&
+       (resp.get_header_value("Accept-Ranges").find("bytes") != std::string::npos));
+    if ((streamer->parallel_streams < 2) ||
+	!ranges ||
+	resp.has_header("Content-Encoding") ||
+	(streamer->request_header.find("Range") != streamer->request_header.end()) ||
+	(total <= streamer->parallel_chunk)) {
+      return;
+    }
+    // workers go straight to the final location of a redirect
+    std::string whost = at.host;
+    int wport = at.port;
+    bool wssl = at.ssl;
+    std::string wpath = at.path;
+    pget.nchunks = (total + streamer->parallel_chunk - 1) / streamer->parallel_chunk;
+    pget.window = 2 * streamer->parallel_streams;
+    limit = streamer->parallel_chunk;
+    // the chunks arrive out of order, they are not added to the disk cache
+    teeing = false;
+    for (size_t i = 1; (i < streamer->parallel_streams) && (i < pget.nchunks); ++i) {
+      workers.emplace_back(std::async(std::launch::async, worker, whost, wport, wssl, wpath));
+    }
+  };
+  // adaptive mode: grow towards 2 x throughput x RTT, re-evaluated every ring's worth of data
+  bool adaptive = (ring->max_size() > ring->size());
+  size_t received = 0;
+  size_t next_check = ring->size();
+  auto adapt = [&](size_t n) {
+    received += n;
+    if (!adaptive || (received < next_check)) {
+      return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - t_header).count();
+    double rtt = std::chrono::duration<double>(t_header - t_request).count();
+    if (elapsed > 0) {
+      double bdp = received / elapsed * rtt;
+      ring->grow(2 * bdp);
+    }
+    next_check = received + ring->size();
+  };
+
+  // copies the body into chunk sized pieces of the disk cache
+  auto teeWrite = [&](const char* data, size_t len) {
+    size_t cs = disk->ChunkSize();
+    while (len) {
+      size_t n = std::min(len, cs - tee.size());
+      tee.insert(tee.end(), data, data + n);
+      data += n;
+      len -= n;
+      if (tee.size() == cs) {
+	disk->WriteChunk(origin, tee_index++, tee.data(), tee.size());
+	tee.clear();
+      }
+    }
+  };
 
-  cli->set_follow_location(true);
-  auto res = cli->Get(
-		      path,
+  httplib::Result res;
+  for (int hop = 0; ; ++hop) {
+    redirected = false;
+    res = cli->Get(
+		      at.path,
 		      hd,
-		      [&](const httplib::Response &resp) {
-			if (0) {
-			  std::cerr << "Response: " << resp.status << std::endl;
+		      on_response,
+		      [&](size_t& length) -> char* {
+			if (redirected || skip) {
+			  length = std::min(length, sizeof(sink));
+			  if (skip) {
+			    length = std::min(length, skip);
+			  }
+			  return sink;
 			}
-			streamer->setResponse(resp);
-			streamer->NotifyHeader();
-			//			RingBufferFDManager::set_eof(fd);
-			return true; // return 'false' if you want to cancel the request.
+			// let httplib receive straight into the ring
+			length = ring->reserve(span, std::min(length, limit - received));
+			return span;
 		      },
 		      [&](const char *data, size_t data_length) {
-			//		       std::cerr << "[write] " << data_length << std::endl;
-#ifdef USE_RING_BUFFER
-			RingBufferFDManager::write(fd, data, data_length);
+			if (redirected) {
+			  return !streamer->cancel;
+			}
+			if (skip) {
+			  size_t n = std::min(skip, data_length);
+			  skip -= n;
+			  data += n;
+			  data_length -= n;
+			  if (!data_length) {
+			    return !streamer->cancel;
+			  }
+			}
+			if ((received + data_length > limit) || streamer->cancel) {
+			  return false;
+			}
+			if (teeing) {
+			  teeWrite(data, data_length);
+			}
+			if (data == span) {
+			  ring->commit(data_length);
+			} else {
+			  // decoded content is delivered from httplib's own buffer
+			  ring->write(data, data_length);
+			}
+			adapt(data_length);
+			// in parallel mode the first connection only delivers chunk 0
+			return (received < limit); // return 'false' if you want to cancel the request.
+		      });
+    if (!res || !redirected) {
+      break;
+    }
+    if (hop + 1 >= REDIRECT_MAX_HOPS) {
+      res = httplib::Result(nullptr, httplib::Error::ExceedRedirectCount);
+      break;
+    }
+    cli = HttPosix::Client(at.host, at.port, at.ssl);
+  }
+
+  if (res && teeing && !tee.empty() && (tee_index * disk->ChunkSize() + tee.size() == streamer->size)) {
+    // the short last chunk
+    disk->WriteChunk(origin, tee_index, tee.data(), tee.size());
+  }
+  if (res && from_disk) {
+    size_t cs = disk->ChunkSize();
+    std::vector<char> chunk(cs);
+    for (off_t off = base; ((size_t)off < cached.size) && !streamer->cancel; ) {
+      size_t in = off % cs;
+      size_t n = std::min(cs - in, cached.size - off);
+      if ((disk->ReadChunk(origin, off / cs, chunk.data(), n, in) != (ssize_t)n) &&
+	  !getRange(*cli, at.path, streamer->request_header, off, n, chunk.data(), streamer->cancel)) {
+	// evicted meanwhile and not available from the server either
+	res = httplib::Result(nullptr, httplib::Error::Read);
+	break;
+      }
+      if (ring->write(chunk.data(), n) != n) {
+	break;
+      }
+      off += n;
+    }
+  }
+
+  if (pget.nchunks) {
+    bool ok = (received == limit);
+    // append the staged chunks in order
+    for (size_t k = 1; ok && (k < pget.nchunks); ++k) {
+      std::vector<char> chunk;
+      {
+	std::unique_lock<std::mutex> lock(pget.mtx);
+	pget.write_chunk = k;
+	pget.cv.notify_all();
+	pget.cv.wait(lock, [&] { return pget.failed || streamer->cancel || pget.staged.count(k); });
+	if (pget.failed || streamer->cancel) {
+	  break;
+	}
+	chunk = std::move(pget.staged[k]);
+	pget.staged.erase(k);
+      }
+      pget.cv.notify_all();
+      ok = (ring->write(chunk.data(), chunk.size()) == chunk.size());
+    }
+    {
+      std::lock_guard<std::mutex> lock(pget.mtx);
+      pget.stop = true;
+    }
+    pget.cv.notify_all();
+    for (auto& w : workers) {
+      w.wait();
+    }
+    if (ok && !pget.failed) {
+      // chunk 0 was cut short on purpose
+      res = httplib::Result(std::make_unique<httplib::Response>(*streamer->response), httplib::Error::Success);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(streamer->mtx);
+    streamer->pget = nullptr;
+  }
 #else
-			::write(fd, data, data_length);
-#endif
+  httplib::Result res;
+  for (int hop = 0; ; ++hop) {
+    redirected = false;
+    res = cli->Get(
+		      at.path,
+		      hd,
+		      on_response,
+		      [&](const char *data, size_t data_length) {
+			//		       std::cerr << "[write] " << data_length << std::endl;
+			if (streamer->cancel) {
+			  return false;
+			}
+			if (!redirected) {
+			  ::write(fd, data, data_length);
+			}
 			//		       std::cerr << "recv: " << data_length << std::endl;
 			return true; // return 'false' if you want to cancel the request.
 		      });
+    if (!res || !redirected) {
+      break;
+    }
+    if (hop + 1 >= REDIRECT_MAX_HOPS) {
+      res = httplib::Result(nullptr, httplib::Error::ExceedRedirectCount);
+      break;
+    }
+    cli = HttPosix::Client(at.host, at.port, at.ssl);
+  }
+#endif
 
-  RingBufferFDManager::set_eof(fd);
-  if (!res) {
+  if (!res && via_cache && (res.error() != httplib::Error::Canceled)) {
+    HttPosixRedirectCache::Invalidate(origin);
+  }
+  if (!res && !streamer->cancel) {
+    // the caller may have seen a 200 already, Read reports the truncated body
+    if (!streamer->error) {
+      streamer->error = EIO;
+    }
     auto resp = new httplib::Response();
     resp->status = (int)res.error();
     streamer->setResponse(*resp);
     streamer->NotifyHeader();
   }
+#ifdef USE_RING_BUFFER
+  // fd is the ring's eventfd owned by RingBufferFDManager, don't close it here
+  ring->set_eof();
+#else
   ::close(fd);
+#endif
   return 0;
 } 
 
@@ -128,6 +767,149 @@ int HttPosixFileStreamer::httpGet(const std::string& host, int port, bool ssl, c
 void HttPosixFileStreamer::setResponse(const httplib::Response& resp) {
   response = std::make_shared<httplib::Response> (resp);
   size = response->get_header_value_u64("Content-Length");
+  if (response->status == httplib::StatusCode::PartialContent_206) {
+    // Content-Range carries the object size
+    size_t total = contentRangeTotal(*response);
+    if (total) {
+      size = total;
+    }
+  }
+}
+
+/* -------------------------------------------------------------------------- */
+// negative errno for an HTTP status, 0 for success
+static int statusErrno(int status) {
+  if ((status >= 200) && (status < 300)) {
+    return 0;
+  }
+  switch (status) {
+  case httplib::StatusCode::NotFound_404:
+  case httplib::StatusCode::Gone_410:
+    return -ENOENT;
+  case httplib::StatusCode::Unauthorized_401:
+  case httplib::StatusCode::Forbidden_403:
+    return -EACCES;
+  case httplib::StatusCode::MethodNotAllowed_405:
+  case httplib::StatusCode::NotImplemented_501:
+    return -ENOTSUP;
+  case httplib::StatusCode::Conflict_409:
+  case httplib::StatusCode::PreconditionFailed_412:
+    return -EEXIST;
+  case httplib::StatusCode::PayloadTooLarge_413:
+  case httplib::StatusCode::InsufficientStorage_507:
+    return -ENOSPC;
+  case httplib::StatusCode::RequestTimeout_408:
+  case httplib::StatusCode::GatewayTimeout_504:
+    return -ETIMEDOUT;
+  default:
+    return -EIO;
+  }
+}
+
+// negative errno for a failed request
+static int errorErrno(httplib::Error error) {
+  switch (error) {
+  case httplib::Error::Connection:
+    return -EHOSTUNREACH;
+  case httplib::Error::ConnectionTimeout:
+    return -ETIMEDOUT;
+  case httplib::Error::SSLConnection:
+  case httplib::Error::SSLServerVerification:
+    return -EACCES;
+  default:
+    return -EIO;
+  }
+}
+
+// splits a URL for the per-host calls, false if it can't be parsed
+static bool parseUrl(const std::string& url, std::string& host, int& port, bool& ssl, std::string& path) {
+  try {
+    uri u(url);
+    host = u.get_host();
+    port = u.get_port();
+    ssl = (u.get_scheme() == "https");
+    path = u.get_pathcgi();
+  } catch (...) {
+    return false;
+  }
+  if (path.empty() || (path[0] != '/')) {
+    // uri keeps the path without its root
+    path.insert(0, "/");
+  }
+  return true;
+}
+
+// runs run(0..n-1) on up to 'parallel' threads, each pulling the next index
+static void forEachParallel(size_t n, size_t parallel, const std::function<void(size_t)>& run) {
+  std::atomic<size_t> next(0);
+  std::vector<std::future<void>> workers;
+  for (size_t w = 1; w < std::min(parallel, n); ++w) {
+    workers.emplace_back(std::async(std::launch::async, [&]() {
+      for (size_t k; (k = next++) < n;) {
+	run(k);
+      }
+    }));
+  }
+  for (size_t k; (k = next++) < n;) {
+    run(k);
+  }
+  for (auto& w : workers) {
+    w.wait();
+  }
+}
+
+// HEAD request, redirects are followed through the redirect cache
+static httplib::Result headRequest(const std::string& host, int port, bool ssl, const std::string& path,
+				   const httplib::Headers& request_hd) {
+  HttPosixRedirectCache::Target at;
+  at.host = host;
+  at.port = port;
+  at.ssl = ssl;
+  at.path = path;
+  std::vector<std::string> cached;   // redirect cache entries used or stored on the way
+  for (int hop = 0; hop < REDIRECT_MAX_HOPS; ++hop) {
+    HttPosixRedirectCache::Target next;
+    std::string key = HttPosixRedirectCache::Key(at.host, at.port, at.ssl, at.path);
+    if (HttPosixRedirectCache::Lookup(key, next)) {
+      cached.push_back(key);
+      at = next;
+      continue;
+    }
+    auto cli = HttPosix::Client(at.host, at.port, at.ssl);
+    auto res = cli->Head(at.path, request_hd);
+    if (!res || (res->status >= 400)) {
+      // the target went away, resolve again next time
+      for (auto& k : cached) {
+	HttPosixRedirectCache::Invalidate(k);
+      }
+    }
+    if (!res || (res->status <= 300) || (res->status >= 400) || !res->has_header("Location")) {
+      return res;
+    }
+    if (!HttPosixRedirectCache::Store(key, at, res.value(), next)) {
+      return res;
+    }
+    cached.push_back(key);
+    at = next;
+  }
+  return httplib::Result(nullptr, httplib::Error::ExceedRedirectCount);
+}
+
+// fills 'buf' from the headers of a HEAD response
+static void statResponse(const httplib::Response& resp, struct stat& buf) {
+  memset(&buf, 0, sizeof(buf));
+  buf.st_mode = S_IFREG | 0444;
+  buf.st_nlink = 1;
+  buf.st_size = resp.get_header_value_u64("Content-Length");
+  buf.st_blksize = 4096;
+  buf.st_blocks = (buf.st_size + 511) / 512;
+  struct tm tm = {};
+  std::string modified = resp.get_header_value("Last-Modified");
+  if (!modified.empty() && strptime(modified.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm)) {
+    buf.st_mtime = timegm(&tm);
+    buf.st_ctime = buf.st_mtime;
+    buf.st_atime = buf.st_mtime;
+  }
 }
 
 /* -------------------------------------------------------------------------- */
@@ -138,30 +920,153 @@ HttPosix::Stat(const std::string host,
 	       const std::string path,
 	       struct stat& buf,
 	       const httplib::Headers& request_hd,
-	       httplib::Headers& response_hd)
+	       httplib::Headers& response_hd,
+	       int* status)
 {
-  auto cli = HttPosix::Client(host, port, ssl);
-  auto res = cli->Head(path, request_hd);
+  std::string key = HttPosixRedirectCache::Key(host, port, ssl, path);
+  bool cacheable = HttPosixStatCache::Cacheable(request_hd);
+  HttPosixStatCache::Entry cached;
+  if (cacheable && HttPosixStatCache::Lookup(key, cached)) {
+    if (!statusErrno(cached.status)) {
+      buf = cached.st;
+    }
+    response_hd = cached.headers;
+    if (status) {
+      *status = cached.status;
+    }
+    return httplib::Error::Success;
+  }
+  auto res = headRequest(host, port, ssl, path, request_hd);
   if (res ) {
-    std::cerr << std::setw(24) << std::left << "Status" << ": " << res->status << std::endl;
-    for (auto i:res->headers) {
-      std::cerr << std::setw(24) << std::left << i.first << ": " << i.second  << std::endl;
+    struct stat st;
+    statResponse(res.value(), st);
+    if (cacheable) {
+      HttPosixStatCache::Store(key, res.value(), st);
+    }
+    // only an existing object describes a file
+    if (!statusErrno(res->status)) {
+      buf = st;
     }
     response_hd = res->headers;
+    if (status) {
+      *status = res->status;
+    }
     return httplib::Error::Success;
   } else {
     return res.error();
   }
 }
 
+/* -------------------------------------------------------------------------- */
+std::vector<HttPosixStat>
+HttPosix::StatMany(const std::vector<std::string>& urls,
+		   const httplib::Headers& request_hd,
+		   size_t parallel)
+{
+  std::vector<HttPosixStat> stats(urls.size());
+  bool cacheable = HttPosixStatCache::Cacheable(request_hd);
+  auto run = [&](size_t k) {
+    HttPosixStat& s = stats[k];
+    std::string host, path;
+    int port;
+    bool ssl;
+    if (!parseUrl(urls[k], host, port, ssl, path)) {
+      s.rc = -EINVAL;
+      return;
+    }
+    std::string key = HttPosixRedirectCache::Key(host, port, ssl, path);
+    HttPosixStatCache::Entry cached;
+    if (cacheable && HttPosixStatCache::Lookup(key, cached)) {
+      s.rc = statusErrno(cached.status);
+      if (!s.rc) {
+	s.st = cached.st;
+      }
+      return;
+    }
+    auto res = headRequest(host, port, ssl, path, request_hd);
+    if (!res) {
+      s.rc = errorErrno(res.error());
+      return;
+    }
+    s.rc = statusErrno(res->status);
+    struct stat st;
+    statResponse(res.value(), st);
+    if (cacheable) {
+      HttPosixStatCache::Store(key, res.value(), st);
+    }
+    if (!s.rc) {
+      s.st = st;
+    }
+  };
+
+  // every worker keeps its pooled connection busy
+  forEachParallel(urls.size(), parallel, run);
+  return stats;
+}
+
 /* -------------------------------------------------------------------------- */
 int
 HttPosix::Mkdir(const std::string host,
 		int port,
 		bool ssl,
-		const std::string path)
+		const std::string path,
+		bool parents,
+		const httplib::Headers& request_hd)
 {
-  return 0;
+  HttPosixStatCache::Invalidate(HttPosixRedirectCache::Key(host, port, ssl, path));
+  httplib::Request req;
+  req.method = "MKCOL";
+  req.path = path;
+  req.headers = request_hd;
+  auto res = HttPosix::Client(host, port, ssl)->send(req);
+  if (!res) {
+    return errorErrno(res.error());
+  }
+  switch (res->status) {
+  case httplib::StatusCode::MethodNotAllowed_405: {
+    // MKCOL on an existing resource, or a server without WebDAV: only the first exists
+    auto head = HttPosix::Client(host, port, ssl)->Head(path, request_hd);
+    if (!head) {
+      return errorErrno(head.error());
+    }
+    if (head->status == httplib::StatusCode::NotFound_404) {
+      return -ENOTSUP;
+    }
+    if (head->status >= 400) {
+      return statusErrno(head->status);
+    }
+    if (!parents) {
+      return -EEXIST;
+    }
+    // like mkdir -p, only an existing collection is fine
+    std::vector<HttPosixDirEntry> self;
+    int rc = ListDir(host, port, ssl, path, self, 0, false, request_hd);
+    if (rc) {
+      return rc;
+    }
+    return (!self.empty() && S_ISDIR(self[0].st.st_mode)) ? 0 : -ENOTDIR;
+  }
+  case httplib::StatusCode::Conflict_409:
+    // an intermediate collection is missing
+    break;
+  default:
+    return statusErrno(res->status);
+  }
+  if (!parents) {
+    return -ENOENT;
+  }
+  // most parents usually exist, so walk up only as far as needed
+  std::string parent = path.substr(0, path.find_last_not_of('/') + 1);
+  auto slash = parent.rfind('/');
+  if ((slash == std::string::npos) || !slash) {
+    return -ENOENT;
+  }
+  parent.resize(slash + 1);
+  int rc = Mkdir(host, port, ssl, parent, true, request_hd);
+  if (!rc) {
+    rc = Mkdir(host, port, ssl, path, false, request_hd);
+  }
+  return (rc == -EEXIST) ? 0 : rc;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -169,39 +1074,1029 @@ int
 HttPosix::Delete(const std::string host,
 		 int port,
 		 bool ssl,
-		 const std::string path)
+		 const std::string path,
+		 const httplib::Headers& request_hd)
 {
-  return 0;
-}
-
-/* -------------------------------------------------------------------------- */
-std::unique_ptr<httplib::Client>
-HttPosix::Client(const std::string host, int port, bool ssl) {
-  std::string uri = (ssl?std::string("https://"):std::string("http://")) + host + std::string(":") + std::to_string(port);
-  auto cli =  std::make_unique<httplib::Client>(uri);
-
-  // Use your CA bundle
-  const char* b=0;
-  if ((b = getenv("HTTPCPP_CA_BUNDLE"))) {
-    cli->set_ca_cert_path(std::string(b));
+  HttPosixStatCache::Invalidate(HttPosixRedirectCache::Key(host, port, ssl, path));
+  auto res = HttPosix::Client(host, port, ssl)->Delete(path, request_hd);
+  if (!res) {
+    return errorErrno(res.error());
   }
-
-  // Disable cert verification
-  if ((b = getenv("HTTPCPP_NO_VERIFY")) && ((std::string(b) == "off") || (std::string(b) == "false") || (std::string(b) == "1"))) {
-    cli->enable_server_certificate_verification(false);
+  if (res->status == httplib::StatusCode::MultiStatus_207) {
+    // some members of the collection could not be deleted
+    return -EIO;
   }
-  return cli;
+  return statusErrno(res->status);
 }
 
 /* -------------------------------------------------------------------------- */
-int HttPosixFile::Open(const std::string host,
-		       int port,
-		       bool ssl,
-		       const std::string path,
-		       const httplib::Headers& request_header)
+std::vector<int>
+HttPosix::DeleteMany(const std::vector<std::string>& urls,
+		     const httplib::Headers& request_hd,
+		     size_t parallel)
 {
-  std::lock_guard<std::mutex> mutx(mtx);
-  if (isopen) {
+  std::vector<int> rcs(urls.size());
+  forEachParallel(urls.size(), parallel, [&](size_t k) {
+    std::string host, path;
+    int port;
+    bool ssl;
+    rcs[k] = parseUrl(urls[k], host, port, ssl, path) ? Delete(host, port, ssl, path, request_hd) : -EINVAL;
+  });
+  return rcs;
+}
+
+// Incremental parser for WebDAV multistatus bodies, fed from a content receiver.
+// Only the text of the element being closed is kept, every <response> is handed
+// to 'emit' as soon as it ends, so memory doesn't grow with the listing.
+class MultistatusParser {
+public:
+  MultistatusParser(const std::function<bool(HttPosixDirEntry&)>& emit) : emit(emit) {}
+
+  // false if the body is malformed or 'emit' asked to stop
+  bool Feed(const char* data, size_t len) {
+    const char* end = data + len;
+    while (data < end) {
+      if (intag) {
+	const char* gt = (const char*)memchr(data, '>', end - data);
+	tag.append(data, gt ? gt - data : end - data);
+	if (tag.size() > MAX_TOKEN) {
+	  return false;
+	}
+	if (!gt) {
+	  break;
+	}
+	data = gt + 1;
+	if (!tag.compare(0, 3, "!--") && ((tag.size() < 5) || tag.compare(tag.size() - 2, 2, "--"))) {
+	  // '>' inside a comment
+	  tag += '>';
+	  continue;
+	}
+	if (!tag.compare(0, 8, "![CDATA[")) {
+	  if ((tag.size() < 10) || tag.compare(tag.size() - 2, 2, "]]")) {
+	    tag += '>';
+	    continue;
+	  }
+	  text.append(tag, 8, tag.size() - 10);
+	} else if (!Tag()) {
+	  return false;
+	}
+	tag.clear();
+	intag = false;
+      } else {
+	const char* lt = (const char*)memchr(data, '<', end - data);
+	text.append(data, lt ? lt - data : end - data);
+	if (text.size() > MAX_TOKEN) {
+	  return false;
+	}
+	if (!lt) {
+	  break;
+	}
+	data = lt + 1;
+	intag = true;
+      }
+    }
+    return true;
+  }
+
+private:
+  static const size_t MAX_TOKEN = 64 * 1024;
+
+  struct Props {
+    bool ok = false;
+    bool collection = false;
+    bool has_size = false;
+    size_t size = 0;
+    time_t mtime = 0;
+    std::string etag;
+  };
+
+  static std::string Unescape(const std::string& s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); ++i) {
+      size_t semi;
+      if ((s[i] != '&') || ((semi = s.find(';', i)) == std::string::npos)) {
+	out += s[i];
+	continue;
+      }
+      std::string entity = s.substr(i + 1, semi - i - 1);
+      if (entity == "amp") {
+	out += '&';
+      } else if (entity == "lt") {
+	out += '<';
+      } else if (entity == "gt") {
+	out += '>';
+      } else if (entity == "quot") {
+	out += '"';
+      } else if (entity == "apos") {
+	out += '\'';
+      } else if (!entity.empty() && (entity[0] == '#')) {
+	unsigned long c = (entity.size() > 1 && (entity[1] == 'x')) ? std::strtoul(entity.c_str() + 2, nullptr, 16) : std::strtoul(entity.c_str() + 1, nullptr, 10);
+	// UTF-8
+	if (c < 0x80) {
+	  out += (char)c;
+	} else if (c < 0x800) {
+	  out += (char)(0xc0 | (c >> 6));
+	  out += (char)(0x80 | (c & 0x3f));
+	} else if (c < 0x10000) {
+	  out += (char)(0xe0 | (c >> 12));
+	  out += (char)(0x80 | ((c >> 6) & 0x3f));
+	  out += (char)(0x80 | (c & 0x3f));
+	} else {
+	  out += (char)(0xf0 | (c >> 18));
+	  out += (char)(0x80 | ((c >> 12) & 0x3f));
+	  out += (char)(0x80 | ((c >> 6) & 0x3f));
+	  out += (char)(0x80 | (c & 0x3f));
+	}
+      } else {
+	out += s.substr(i, semi - i + 1);
+      }
+      i = semi;
+    }
+    return out;
+  }
+
+  static std::string Trim(const std::string& s) {
+    size_t first = s.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) {
+      return std::string();
+    }
+    return s.substr(first, s.find_last_not_of(" \t\r\n") - first + 1);
+  }
+
+  bool Tag() {
+    if (tag.empty() || (tag[0] == '?') || (tag[0] == '!')) {
+      // declarations
+      return true;
+    }
+    bool closing = (tag[0] == '/');
+    bool empty = !closing && (tag.back() == '/');
+    size_t from = closing ? 1 : 0;
+    size_t to = tag.find_first_of(" \t\r\n/", from);
+    std::string name = tag.substr(from, (to == std::string::npos ? tag.size() : to) - from);
+    auto colon = name.find(':');
+    if (colon != std::string::npos) {
+      // namespace prefixes differ between servers
+      name.erase(0, colon + 1);
+    }
+    if (!closing) {
+      Open(name);
+      text.clear();
+      if (!empty) {
+	return true;
+      }
+    }
+    bool rc = Close(name);
+    text.clear();
+    return rc;
+  }
+
+  void Open(const std::string& name) {
+    if (name == "response") {
+      entry = HttPosixDirEntry();
+      in_response = true;
+    } else if (name == "propstat") {
+      props = Props();
+      in_propstat = true;
+    } else if ((name == "collection") && in_propstat) {
+      props.collection = true;
+    }
+  }
+
+  bool Close(const std::string& name) {
+    if (!in_response) {
+      return true;
+    }
+    if (name == "href") {
+      if (!in_propstat) {
+	entry.href = Unescape(Trim(text));
+	entry.path = httplib::detail::decode_url(entry.href, false);
+      }
+    } else if (!in_propstat) {
+      if (name == "response") {
+	in_response = false;
+	return entry.path.empty() || emit(entry);
+      }
+    } else if (name == "getcontentlength") {
+      props.size = std::strtoull(Trim(text).c_str(), nullptr, 10);
+      props.has_size = true;
+    } else if (name == "getlastmodified") {
+      struct tm tm = {};
+      if (strptime(Trim(text).c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm)) {
+	props.mtime = timegm(&tm);
+      }
+    } else if (name == "getetag") {
+      props.etag = Unescape(Trim(text));
+    } else if (name == "status") {
+      props.ok = (text.find(" 200 ") != std::string::npos);
+    } else if (name == "propstat") {
+      in_propstat = false;
+      if (props.ok) {
+	auto& st = entry.st;
+	st.st_mode = props.collection ? (S_IFDIR | 0555) : (S_IFREG | 0444);
+	st.st_nlink = props.collection ? 2 : 1;
+	if (props.has_size) {
+	  st.st_size = props.size;
+	  st.st_blksize = 4096;
+	  st.st_blocks = (st.st_size + 511) / 512;
+	}
+	if (props.mtime) {
+	  st.st_mtime = st.st_ctime = st.st_atime = props.mtime;
+	}
+	if (!props.etag.empty()) {
+	  entry.etag = props.etag;
+	}
+      }
+    }
+    return true;
+  }
+
+  std::function<bool(HttPosixDirEntry&)> emit;
+  bool intag = false;
+  bool in_response = false;
+  bool in_propstat = false;
+  std::string tag;
+  std::string text;
+  HttPosixDirEntry entry;
+  Props props;
+};
+
+/* -------------------------------------------------------------------------- */
+int
+HttPosix::ListDir(const std::string host,
+		  int port,
+		  bool ssl,
+		  const std::string path,
+		  const std::function<bool(const HttPosixDirEntry&)>& callback,
+		  int depth,
+		  bool cache,
+		  const httplib::Headers& request_hd)
+{
+  httplib::Request req;
+  req.method = "PROPFIND";
+  req.path = path;
+  req.headers = request_hd;
+  req.set_header("Depth", (depth < 0) ? std::string("infinity") : std::to_string(depth));
+  req.set_header("Content-Type", "application/xml; charset=utf-8");
+  // only what a stat needs, 'allprop' can be expensive for the server
+  req.body =
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+    "<D:propfind xmlns:D=\"DAV:\"><D:prop>"
+    "<D:resourcetype/><D:getcontentlength/><D:getlastmodified/><D:getetag/>"
+    "</D:prop></D:propfind>";
+
+  // compared decoded, the server may encode other characters than the request did
+  std::string self = httplib::detail::decode_url(path.substr(0, path.find_last_not_of('/') + 1), false);
+  cache = cache && HttPosixStatCache::Cacheable(request_hd);
+  bool stopped = false;
+  MultistatusParser parser([&](HttPosixDirEntry& e) {
+    for (auto p : {&e.path, &e.href}) {
+      if (!p->compare(0, 4, "http")) {
+	// absolute URL
+	auto scheme = p->find("://");
+	auto root = (scheme == std::string::npos) ? std::string::npos : p->find('/', scheme + 3);
+	*p = (root == std::string::npos) ? std::string("/") : p->substr(root);
+      }
+    }
+    std::string trimmed = e.path.substr(0, e.path.find_last_not_of('/') + 1);
+    e.name = trimmed.substr(trimmed.rfind('/') + 1);
+    if (cache) {
+      httplib::Response resp;
+      resp.status = httplib::StatusCode::OK_200;
+      if (!e.etag.empty()) {
+	resp.set_header("ETag", e.etag);
+      }
+      // keyed like the request path of a later Stat, which is encoded
+      HttPosixStatCache::Store(HttPosixRedirectCache::Key(host, port, ssl, e.href), resp, e.st);
+    }
+    if (depth && (trimmed == self)) {
+      return true;
+    }
+    if (!callback(e)) {
+      stopped = true;
+      return false;
+    }
+    return true;
+  });
+  int status = 0;
+  bool malformed = false;
+  req.response_handler = [&](const httplib::Response& resp) {
+    status = resp.status;
+    return true;
+  };
+  req.content_receiver = [&](const char* data, size_t data_length, uint64_t /*offset*/, uint64_t /*total_length*/) {
+    if (status != httplib::StatusCode::MultiStatus_207) {
+      // error bodies are dropped
+      return true;
+    }
+    if (!parser.Feed(data, data_length)) {
+      malformed = !stopped;
+      return false;
+    }
+    return true;
+  };
+  auto res = HttPosix::Client(host, port, ssl)->send(req);
+  if (stopped) {
+    return 0;
+  }
+  if (malformed) {
+    return -EBADMSG;
+  }
+  if (!res) {
+    return errorErrno(res.error());
+  }
+  if (res->status != httplib::StatusCode::MultiStatus_207) {
+    // a plain 200 comes from a server without WebDAV
+    return res->status < 300 ? -ENOTSUP : statusErrno(res->status);
+  }
+  return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+int
+HttPosix::ListDir(const std::string host,
+		  int port,
+		  bool ssl,
+		  const std::string path,
+		  std::vector<HttPosixDirEntry>& entries,
+		  int depth,
+		  bool cache,
+		  const httplib::Headers& request_hd)
+{
+  return ListDir(host, port, ssl, path, [&](const HttPosixDirEntry& e) {
+    entries.push_back(e);
+    return true;
+  }, depth, cache, request_hd);
+}
+
+/* -------------------------------------------------------------------------- */
+int HttPosixFileWriter::Open(const std::string host,
+			     int port,
+			     bool ssl,
+			     const std::string path,
+			     const httplib::Headers& header,
+			     ssize_t size,
+			     size_t ring_size) {
+  if (ft) {
+    errno = EBUSY;
+    return -1;
+  }
+  request_header = header;
+  this->host = host;
+  this->port = port;
+  this->ssl = ssl;
+  this->path = path;
+  this->size = size;
+  file_fd = -1;
+  sent = 0;
+  cancel = false;
+  failed = false;
+  response.reset();
+  ring = std::make_unique<RingBuffer>(ring_size);
+  // the object changes, whatever is cached about it is outdated
+  HttPosixStatCache::Invalidate(HttPosixRedirectCache::Key(host, port, ssl, path));
+  ft = std::make_unique<std::future<int>>(std::async(std::launch::async, httpPut, this));
+  return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+int HttPosixFileWriter::OpenFile(const std::string host,
+				 int port,
+				 bool ssl,
+				 const std::string path,
+				 const httplib::Headers& header,
+				 int fd,
+				 off_t offset,
+				 ssize_t size) {
+  if (ft) {
+    errno = EBUSY;
+    return -1;
+  }
+  struct stat buf;
+  if (::fstat(fd, &buf)) {
+    return -1;
+  }
+  // data is read at offsets, pipes and sockets can't be sent this way
+  if (!S_ISREG(buf.st_mode) && !S_ISBLK(buf.st_mode)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (size < 0) {
+    if (!S_ISREG(buf.st_mode) || (offset > buf.st_size)) {
+      errno = EINVAL;
+      return -1;
+    }
+    size = buf.st_size - offset;
+  }
+  request_header = header;
+  this->host = host;
+  this->port = port;
+  this->ssl = ssl;
+  this->path = path;
+  this->size = size;
+  file_fd = fd;
+  file_offset = offset;
+  sent = 0;
+  cancel = false;
+  failed = false;
+  response.reset();
+  ring.reset();
+  HttPosixStatCache::Invalidate(HttPosixRedirectCache::Key(host, port, ssl, path));
+  ft = std::make_unique<std::future<int>>(std::async(std::launch::async, httpPut, this));
+  return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+ssize_t HttPosixFileWriter::Write(const char* buffer, size_t len) {
+  if (!ft || !ring) {
+    errno = EBADF;
+    return -1;
+  }
+  // the ring is at EOF once the upload thread gave up
+  if (failed || (len && !ring->write(buffer, len))) {
+    errno = EIO;
+    return -1;
+  }
+  return len;
+}
+
+/* -------------------------------------------------------------------------- */
+int HttPosixFileWriter::Close() {
+  if (!ft) {
+    return 0;
+  }
+  if (ring) {
+    ring->set_eof();
+  }
+  int rc = ft->get();
+  ft.reset();
+  ring.reset();
+  HttPosixStatCache::Invalidate(HttPosixRedirectCache::Key(host, port, ssl, path));
+  return rc;
+}
+
+/* -------------------------------------------------------------------------- */
+int HttPosixFileWriter::httpPut(HttPosixFileWriter* writer) {
+  // the body can't be replayed, so only redirects known from the cache are followed
+  HttPosixRedirectCache::Target at;
+  at.host = writer->host;
+  at.port = writer->port;
+  at.ssl = writer->ssl;
+  at.path = writer->path;
+  for (int hop = 0; hop < REDIRECT_MAX_HOPS; ++hop) {
+    HttPosixRedirectCache::Target next;
+    if (!HttPosixRedirectCache::Lookup(HttPosixRedirectCache::Key(at.host, at.port, at.ssl, at.path), next)) {
+      break;
+    }
+    at = next;
+  }
+
+  httplib::Headers hd = writer->request_header;
+  std::string content_type = httplib::detail::get_header_value(hd, "Content-Type", 0, "application/octet-stream");
+  hd.erase("Content-Type");
+  RingBuffer* ring = writer->ring.get();
+
+  // only file uploads gain from kernel TLS
+  auto cli = HttPosix::Client(at.host, at.port, at.ssl, writer->file_fd >= 0);
+  httplib::Result res;
+  if (writer->file_fd >= 0) {
+    res = cli->Put(at.path, hd, writer->size,
+		   [&](size_t offset, size_t length, httplib::DataSink& sink) {
+		     if (writer->cancel) {
+		       return false;
+		     }
+		     // in slices, so Sent() moves and a cancel is noticed
+		     size_t n = std::min(length, (size_t)SENDFILE_CHUNK_SIZE);
+		     if (!sink.sendfile(writer->file_fd, writer->file_offset + offset, n)) {
+		       return false;
+		     }
+		     writer->sent += n;
+		     return true;
+		   },
+		   content_type);
+  } else if (writer->size >= 0) {
+    res = cli->Put(at.path, hd, writer->size,
+		   [&](size_t /*offset*/, size_t length, httplib::DataSink& sink) {
+		     const char* span;
+		     size_t n = ring->peek(span, length);
+		     if (!n || writer->cancel) {
+		       // closed before the announced length was written
+		       return false;
+		     }
+		     bool ok = sink.write(span, n);
+		     ring->consume(n);
+		     writer->sent += n;
+		     return ok;
+		   },
+		   content_type);
+  } else {
+    res = cli->Put(at.path, hd,
+		   [&](size_t /*offset*/, httplib::DataSink& sink) {
+		     const char* span;
+		     size_t n = ring->peek(span, BUFFER_SIZE);
+		     if (writer->cancel) {
+		       return false;
+		     }
+		     if (!n) {
+		       sink.done();
+		       return true;
+		     }
+		     bool ok = sink.write(span, n);
+		     ring->consume(n);
+		     writer->sent += n;
+		     return ok;
+		   },
+		   content_type);
+  }
+
+  int rc;
+  if (res) {
+    writer->response = std::make_shared<httplib::Response>(res.value());
+    rc = res->status;
+    if ((rc > 300) && (rc < 400) && res->has_header("Location")) {
+      // the next upload goes to the new location directly
+      HttPosixRedirectCache::Target next;
+      HttPosixRedirectCache::Store(HttPosixRedirectCache::Key(at.host, at.port, at.ssl, at.path), at, res.value(), next);
+    }
+  } else {
+    rc = (res.error() == httplib::Error::Canceled) ? -EIO : errorErrno(res.error());
+  }
+  if (!res || (rc >= 300)) {
+    writer->failed = true;
+  }
+  // wakes a producer blocked on the full ring of a failed or early answered upload
+  if (ring) {
+    ring->set_eof();
+  }
+  return rc;
+}
+
+/* -------------------------------------------------------------------------- */
+HttPosixClient
+HttPosix::Client(const std::string host, int port, bool ssl, bool ktls) {
+  return HttPosixClientPool::Get(host, port, ssl, ktls);
+}
+
+/* -------------------------------------------------------------------------- */
+void HttPosixClientReleaser::operator()(httplib::Client* cli) const {
+  HttPosixClientPool::Put(key, cli);
+}
+
+/* -------------------------------------------------------------------------- */
+HttPosixClient
+HttPosixClientPool::Get(const std::string& host, int port, bool ssl, bool ktls) {
+  std::string uri = (ssl?std::string("https://"):std::string("http://")) + host + std::string(":") + std::to_string(port);
+
+  const char* b=0;
+  std::string ca_bundle = (b = getenv("HTTPCPP_CA_BUNDLE")) ? b : "";
+  bool no_verify = (b = getenv("HTTPCPP_NO_VERIFY")) && ((std::string(b) == "off") || (std::string(b) == "false") || (std::string(b) == "1"));
+  // clients are only shared between users with identical TLS settings
+  std::string key = uri + "|" + ca_bundle + "|" + (no_verify ? "noverify" : "verify");
+#ifdef SSL_OP_ENABLE_KTLS
+  // kernel TLS lets file uploads use SSL_sendfile, OpenSSL stays in user space if the
+  // kernel lacks it; HTTPCPP_KTLS=0 turns it off
+  ktls = ktls && ssl && !((b = getenv("HTTPCPP_KTLS")) && !strcmp(b, "0"));
+#else
+  ktls = false;
+#endif
+  if (ktls) {
+    key += "|ktls";
+  }
+
+  std::unique_ptr<httplib::Client> cli;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = idle.find(key);
+    time_t now = time(NULL);
+    while ((it != idle.end()) && !it->second.empty()) {
+      // most recently used first, it is the most likely one to be alive
+      Idle entry = std::move(it->second.back());
+      it->second.pop_back();
+      if ((now - entry.since) > idle_timeout) {
+	continue;
+      }
+      if (entry.cli->is_socket_open() && !entry.cli->is_socket_alive()) {
+	continue;
+      }
+      cli = std::move(entry.cli);
+      break;
+    }
+  }
+
+  if (!cli) {
+    cli =  std::make_unique<httplib::Client>(uri);
+
+    // Use your CA bundle
+    if (!ca_bundle.empty()) {
+      // the path is still needed by clients httplib creates to follow redirects
+      cli->set_ca_cert_path(ca_bundle);
+      X509_STORE* store = ssl ? CaStore(ca_bundle) : nullptr;
+      if (store) {
+	// the client's SSL context takes over this reference
+	cli->set_ca_cert_store(store);
+      }
+    }
+
+    // Disable cert verification
+    if (no_verify) {
+      cli->enable_server_certificate_verification(false);
+    }
+
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+    // resume TLS sessions of earlier connections to the same server
+    if (ssl) {
+      cli->set_ssl_session_cache(SessionCache());
+    }
+#ifdef SSL_OP_ENABLE_KTLS
+    if (ktls) {
+      SSL_CTX_set_options(cli->ssl_context(), SSL_OP_ENABLE_KTLS);
+    }
+#endif
+#endif
+  }
+
+  // reset what users of the previous lease may have changed
+  cli->set_keep_alive(true);
+  cli->set_follow_location(false);
+  return HttPosixClient(cli.release(), HttPosixClientReleaser{key});
+}
+
+/* -------------------------------------------------------------------------- */
+void
+HttPosixClientPool::Put(const std::string& key, httplib::Client* cli) {
+  std::unique_ptr<httplib::Client> owned(cli);
+  if (!owned || !owned->is_socket_open()) {
+    // nothing to reuse
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  auto& list = idle[key];
+  time_t now = time(NULL);
+  // expire idle clients of this key
+  list.erase(std::remove_if(list.begin(), list.end(),
+			    [&](const Idle& e) { return (now - e.since) > idle_timeout; }),
+	     list.end());
+  if (list.size() >= max_per_host) {
+    return;
+  }
+  list.push_back(Idle{std::move(owned), now});
+}
+
+/* -------------------------------------------------------------------------- */
+void HttPosixClientPool::SetIdleTimeout(time_t seconds) {
+  std::lock_guard<std::mutex> lock(mtx);
+  idle_timeout = seconds;
+}
+
+/* -------------------------------------------------------------------------- */
+void HttPosixClientPool::SetMaxPerHost(size_t n) {
+  std::lock_guard<std::mutex> lock(mtx);
+  max_per_host = n;
+}
+
+/* -------------------------------------------------------------------------- */
+void HttPosixClientPool::Clear() {
+  std::lock_guard<std::mutex> lock(mtx);
+  idle.clear();
+}
+
+/* -------------------------------------------------------------------------- */
+X509_STORE*
+HttPosixClientPool::CaStore(const std::string& bundle) {
+  struct stat buf;
+  if (::stat(bundle.c_str(), &buf)) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(ca_mtx);
+  if (!ca_store || (ca_path != bundle) ||
+      (ca_mtime.tv_sec != buf.st_mtim.tv_sec) || (ca_mtime.tv_nsec != buf.st_mtim.tv_nsec)) {
+    X509_STORE* store = X509_STORE_new();
+    if (!store || (X509_STORE_load_locations(store, bundle.c_str(), nullptr) != 1)) {
+      X509_STORE_free(store);
+      return nullptr;
+    }
+    // clients still using the previous store keep their own reference
+    X509_STORE_free(ca_store);
+    ca_store = store;
+    ca_path = bundle;
+    ca_mtime = buf.st_mtim;
+  }
+  X509_STORE_up_ref(ca_store);
+  return ca_store;
+}
+
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+/* -------------------------------------------------------------------------- */
+std::shared_ptr<httplib::SSLSessionCache> HttPosixClientPool::SessionCache() {
+  static auto cache = std::make_shared<httplib::SSLSessionCache>();
+  return cache;
+}
+#endif
+
+/* -------------------------------------------------------------------------- */
+std::string
+HttPosixRedirectCache::Key(const std::string& host, int port, bool ssl, const std::string& path) {
+  return (ssl?std::string("https://"):std::string("http://")) + host + std::string(":") + std::to_string(port) + path;
+}
+
+/* -------------------------------------------------------------------------- */
+bool
+HttPosixRedirectCache::Lookup(const std::string& key, Target& target, time_t* expires) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = entries.find(key);
+  if (it == entries.end()) {
+    return false;
+  }
+  if (it->second.expires <= time(NULL)) {
+    lru.erase(it->second.lru);
+    entries.erase(it);
+    return false;
+  }
+  lru.splice(lru.begin(), lru, it->second.lru);
+  target = it->second.target;
+  if (expires) {
+    *expires = it->second.expires;
+  }
+  return true;
+}
+
+/* -------------------------------------------------------------------------- */
+bool
+HttPosixRedirectCache::Store(const std::string& key, const Target& from, const httplib::Response& resp, Target& target, time_t* expires) {
+  std::string loc = resp.get_header_value("Location");
+  if (loc.empty()) {
+    return false;
+  }
+  if (loc[0] == '/') {
+    // relative to the server which redirected
+    target = from;
+    target.path = loc;
+  } else {
+    try {
+      uri geturi(loc);
+      target.host = geturi.get_host();
+      target.port = geturi.get_port();
+      target.ssl  = (geturi.get_scheme() == "https");
+      target.path = geturi.get_pathcgi();
+    } catch (...) {
+      return false;
+    }
+    if (target.path.empty() || (target.path[0] != '/')) {
+      // uri keeps the path without its root
+      target.path.insert(0, "/");
+    }
+  }
+
+  time_t expiry = Expiry(resp, loc);
+  if (expires) {
+    *expires = expiry;
+  }
+  if (expiry <= time(NULL)) {
+    // usable once, but not cacheable
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = entries.find(key);
+  if (it != entries.end()) {
+    lru.erase(it->second.lru);
+    entries.erase(it);
+  }
+  while (!lru.empty() && (entries.size() >= max_entries)) {
+    entries.erase(lru.back());
+    lru.pop_back();
+  }
+  if (max_entries) {
+    lru.push_front(key);
+    entries[key] = Entry{target, expiry, lru.begin()};
+  }
+  return true;
+}
+
+/* -------------------------------------------------------------------------- */
+void
+HttPosixRedirectCache::Invalidate(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = entries.find(key);
+  if (it != entries.end()) {
+    lru.erase(it->second.lru);
+    entries.erase(it);
+  }
+}
+
+/* -------------------------------------------------------------------------- */
+void HttPosixRedirectCache::SetMaxEntries(size_t n) {
+  std::lock_guard<std::mutex> lock(mtx);
+  max_entries = n;
+  while (entries.size() > max_entries) {
+    entries.erase(lru.back());
+    lru.pop_back();
+  }
+}
+
+/* -------------------------------------------------------------------------- */
+void HttPosixRedirectCache::SetDefaultTTL(time_t seconds) {
+  std::lock_guard<std::mutex> lock(mtx);
+  default_ttl = seconds;
+}
+
+/* -------------------------------------------------------------------------- */
+bool
+HttPosixStatCache::Lookup(const std::string& key, Entry& entry) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = entries.find(key);
+  if (it == entries.end()) {
+    return false;
+  }
+  if (it->second.expires <= time(NULL)) {
+    lru.erase(it->second.lru);
+    entries.erase(it);
+    return false;
+  }
+  lru.splice(lru.begin(), lru, it->second.lru);
+  entry = it->second;
+  return true;
+}
+
+/* -------------------------------------------------------------------------- */
+void
+HttPosixStatCache::Store(const std::string& key, const httplib::Response& resp, const struct stat& st) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = entries.find(key);
+  if (it != entries.end()) {
+    lru.erase(it->second.lru);
+    entries.erase(it);
+  }
+  time_t seconds = 0;
+  if ((resp.status >= 200) && (resp.status < 300)) {
+    seconds = ttl;
+  } else if ((resp.status == httplib::StatusCode::NotFound_404) ||
+	     (resp.status == httplib::StatusCode::Gone_410)) {
+    seconds = negative_ttl;
+  }
+  if (!seconds || !max_entries) {
+    return;
+  }
+  while (!lru.empty() && (entries.size() >= max_entries)) {
+    entries.erase(lru.back());
+    lru.pop_back();
+  }
+  lru.push_front(key);
+  Entry& entry = entries[key];
+  entry.status = resp.status;
+  entry.st = st;
+  entry.headers = resp.headers;
+  entry.expires = time(NULL) + seconds;
+  entry.lru = lru.begin();
+}
+
+/* -------------------------------------------------------------------------- */
+std::string
+HttPosixStatCache::ETag(const std::string& key) {
+  Entry entry;
+  if (!Lookup(key, entry) || (entry.status < 200) || (entry.status >= 300)) {
+    return std::string();
+  }
+  auto etag = entry.headers.find("ETag");
+  if ((etag == entry.headers.end()) || !etag->second.compare(0, 2, "W/")) {
+    // If-Match compares strongly, a weak ETag would fail every read
+    return std::string();
+  }
+  return etag->second;
+}
+
+/* -------------------------------------------------------------------------- */
+bool
+HttPosixStatCache::Cacheable(const httplib::Headers& request_hd) {
+  return !request_hd.count("Authorization") && !request_hd.count("Cookie");
+}
+
+/* -------------------------------------------------------------------------- */
+void
+HttPosixStatCache::Invalidate(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = entries.find(key);
+  if (it != entries.end()) {
+    lru.erase(it->second.lru);
+    entries.erase(it);
+  }
+}
+
+/* -------------------------------------------------------------------------- */
+void HttPosixStatCache::SetMaxEntries(size_t n) {
+  std::lock_guard<std::mutex> lock(mtx);
+  max_entries = n;
+  while (entries.size() > max_entries) {
+    entries.erase(lru.back());
+    lru.pop_back();
+  }
+}
+
+/* -------------------------------------------------------------------------- */
+void HttPosixStatCache::SetTTL(time_t seconds, time_t negative_seconds) {
+  std::lock_guard<std::mutex> lock(mtx);
+  ttl = seconds;
+  negative_ttl = negative_seconds;
+}
+
+/* -------------------------------------------------------------------------- */
+void HttPosixStatCache::Clear() {
+  std::lock_guard<std::mutex> lock(mtx);
+  entries.clear();
+  lru.clear();
+}
+
+/* -------------------------------------------------------------------------- */
+void HttPosixRedirectCache::Clear() {
+  std::lock_guard<std::mutex> lock(mtx);
+  entries.clear();
+  lru.clear();
+}
+
+// value of 'name=' in a comma or '&' separated list, empty if missing
+static std::string listValue(const std::string& list, const std::string& name, char sep) {
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(sep, pos);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    size_t b = list.find_first_not_of(" \t", pos);
+    if ((b < end) && !strncasecmp(list.c_str() + b, name.c_str(), name.size()) &&
+	(list[b + name.size()] == '=')) {
+      return list.substr(b + name.size() + 1, end - b - name.size() - 1);
+    }
+    pos = end + 1;
+  }
+  return "";
+}
+
+/* -------------------------------------------------------------------------- */
+time_t
+HttPosixRedirectCache::Expiry(const httplib::Response& resp, const std::string& location) {
+  time_t now = time(NULL);
+  time_t ttl;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    ttl = default_ttl;
+  }
+  time_t expiry = now + ttl;
+
+  std::string cc = resp.get_header_value("Cache-Control");
+  std::string maxage = listValue(cc, "s-maxage", ',');
+  if (maxage.empty()) {
+    maxage = listValue(cc, "max-age", ',');
+  }
+  if ((cc.find("no-store") != std::string::npos) ||
+      (cc.find("no-cache") != std::string::npos)) {
+    return 0;
+  }
+  if (!maxage.empty()) {
+    expiry = now + std::strtol(maxage.c_str(), nullptr, 10);
+  } else if (resp.has_header("Expires")) {
+    struct tm tm = {};
+    std::string expires = resp.get_header_value("Expires");
+    if (!strptime(expires.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm)) {
+      // invalid dates mean 'already expired'
+      return 0;
+    }
+    expiry = timegm(&tm);
+  }
+
+  // a signed target URL must not be used beyond its own expiry
+  auto q = location.find('?');
+  if (q != std::string::npos) {
+    std::string query = location.substr(q + 1);
+    std::string amzdate = listValue(query, "X-Amz-Date", '&');
+    std::string amzexpires = listValue(query, "X-Amz-Expires", '&');
+    std::string expires = listValue(query, "Expires", '&');
+    time_t signed_expiry = 0;
+    if (!amzdate.empty() && !amzexpires.empty()) {
+      // AWS signature v4: X-Amz-Date=20240101T000000Z&X-Amz-Expires=<seconds>
+      struct tm tm = {};
+      if (strptime(amzdate.c_str(), "%Y%m%dT%H%M%SZ", &tm)) {
+	signed_expiry = timegm(&tm) + std::strtol(amzexpires.c_str(), nullptr, 10);
+      }
+    } else if (!expires.empty()) {
+      // AWS signature v2 and CloudFront: Expires=<epoch>
+      signed_expiry = std::strtol(expires.c_str(), nullptr, 10);
+    }
+    if (signed_expiry && (signed_expiry < expiry)) {
+      expiry = signed_expiry;
+    }
+  }
+  return expiry;
+}
+
+/* -------------------------------------------------------------------------- */
+int HttPosixFile::Open(const std::string host,
+		       int port,
+		       bool ssl,
+		       const std::string path,
+		       const httplib::Headers& request_header)
+{
+  std::lock_guard<std::mutex> mutx(mtx);
+  if (isopen) {
     return EINVAL;
   }
   location.host = host;
@@ -223,14 +2118,61 @@ int HttPosixFile::_Open(const std::string host,
     std::cerr << "[debug] Open [" << host << ":" << port << "{" << (ssl?std::string("https"):std::string("http")) << "} ]" << std::endl;
   }
   this->request_header = request_header;
+
+  // another file may have resolved the same redirection already
+  std::string key = HttPosixRedirectCache::Key(host, port, ssl, path);
+  // reads stay on the version a recent Stat has seen
+  if_match = false;
+  if_match_failed = false;
+  std::string etag = HttPosixStatCache::Cacheable(request_header) ? HttPosixStatCache::ETag(key) : std::string();
+  if (!etag.empty() && !this->request_header.count("If-Match")) {
+    this->request_header.insert({"If-Match", etag});
+    if_match = true;
+  }
+  HttPosixRedirectCache::Target target;
+  time_t expires = 0;
+  if (HttPosixRedirectCache::Lookup(key, target, &expires)) {
+    redirection = Location(target.host, target.port, target.ssl, target.path);
+    redirection.cached = true;
+    location_validity = expires;
+    isopen = true;
+    if (debug) {
+      std::cerr << "[debug] redirection.cached   : " << key << std::endl;
+      std::cerr << "[debug] redirection.host     : " << redirection.host << std::endl;
+      std::cerr << "[debug] redirection.port     : " << redirection.port << std::endl;
+      std::cerr << "[debug] redirection.ssl      : " << redirection.ssl  << std::endl;
+      std::cerr << "[debug] redirection.path     : " << redirection.path << std::endl;
+      std::cerr << "[debug] redirection.validity : " << location_validity << std::endl;
+    }
+    DiskValidate(nullptr);
+    return 0;
+  }
+
+  if (!disk) {
+    // nothing to probe for, the first request resolves redirects and the size
+    redirection = Location(host, port, ssl, path);
+    location_validity = 0;
+    lazy = true;
+    isopen = true;
+    if (debug) {
+      std::cerr << "[debug] redirection        : deferred to the first request" << std::endl;
+    }
+    return 0;
+  }
+
+  // the probe revalidates the disk cache along with resolving redirects
   auto cli = HttPosix::Client(host, port, ssl);
 
   httplib::Headers hd = request_header;
   // rewrite the range header
   auto range = hd.equal_range("Range");
   hd.erase(range.first, range.second);
-  hd.insert(std::pair<std::string,std::string>("Range", "0-0"));
+  hd.insert(std::pair<std::string,std::string>("Range", "bytes=0-0"));
   httplib::Ranges ranges;
+  HttDiskCache::Validator cached;
+  if (disk->GetValidator(key, cached)) {
+    diskConditional(hd, cached);
+  }
   
   res = cli->Get(path, hd);
   
@@ -241,48 +2183,254 @@ int HttPosixFile::_Open(const std::string host,
 	std::cerr << "[debug]" << std::setw(24) << std::left << i.first << ": " << i.second  << std::endl;
       }
     }
-    response_header = res->headers;
-    isopen = true;
-    if (res->has_header("Location")) {
-      auto loc = res->get_header_value("Location");
-      location_validity = time(NULL) + 30;
-      try {
-	uri geturi(loc);
-	redirection.host = geturi.get_host();
-	redirection.port = geturi.get_port();
-	redirection.ssl  = (geturi.get_scheme() == "https");
-	redirection.path = geturi.get_pathcgi();
-	if (debug) {
-	  std::cerr << "[debug] redirection.host     : " << redirection.host << std::endl;
-	  std::cerr << "[debug] redirection.port     : " << redirection.port << std::endl;
-	  std::cerr << "[debug] redirection.ssl      : " << redirection.ssl  << std::endl;
-	  std::cerr << "[debug] redirection.path     : " << redirection.path << std::endl;
-	  std::cerr << "[debug] redirection.validity : " << location_validity << std::endl;
-	}
-      } catch (...) {
-	// invalid URI received
-	std::cerr << "[open]: received invalid redirection URL : '" << loc << "'" << std::endl;
+    response_header = res->headers;
+    if (res->status == httplib::StatusCode::PartialContent_206) {
+      size = contentRangeTotal(res.value());
+    }
+    isopen = true;
+    if (res->has_header("Location")) {
+      auto loc = res->get_header_value("Location");
+      HttPosixRedirectCache::Target from;
+      from.host = host;
+      from.port = port;
+      from.ssl = ssl;
+      from.path = path;
+      if (HttPosixRedirectCache::Store(key, from, res.value(), target, &expires)) {
+	redirection = Location(target.host, target.port, target.ssl, target.path);
+	// a non-cacheable redirect is valid for this request only
+	location_validity = expires ? expires : 1;
+	if (debug) {
+	  std::cerr << "[debug] redirection.host     : " << redirection.host << std::endl;
+	  std::cerr << "[debug] redirection.port     : " << redirection.port << std::endl;
+	  std::cerr << "[debug] redirection.ssl      : " << redirection.ssl  << std::endl;
+	  std::cerr << "[debug] redirection.path     : " << redirection.path << std::endl;
+	  std::cerr << "[debug] redirection.validity : " << location_validity << std::endl;
+	}
+      } else {
+	// invalid URI received
+	std::cerr << "[open]: received invalid redirection URL : '" << loc << "'" << std::endl;
+	return -1;
+      }
+      isopen = true;
+      DiskValidate(nullptr);
+      return 0;
+    } else {
+      location_validity = 0;
+      redirection = location;
+      isopen = true;
+      if (debug) {
+	std::cerr << "[debug] redirection.host     : " << redirection.host << std::endl;
+	std::cerr << "[debug] redirection.port     : " << redirection.port << std::endl;
+	std::cerr << "[debug] redirection.ssl      : " << redirection.ssl  << std::endl;
+	std::cerr << "[debug] redirection.path     : " << redirection.path << std::endl;
+	std::cerr << "[debug] redirection.validity : unlimited" << std::endl;
+      }
+      DiskValidate(&res.value());
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+/* -------------------------------------------------------------------------- */
+int HttPosixFile::ReOpen()
+{
+  if (!isopen) {
+    return -EINVAL;
+  }
+  if (if_match && (if_match_failed || !Valid())) {
+    // once a 412 has been reported reads get the current version; _Open takes
+    // the ETag from the stat cache again
+    request_header.erase("If-Match");
+    if_match = false;
+  }
+  if_match_failed = false;
+  if (!Valid()) {
+    return _Open(location.host, location.port, location.ssl, location.path, request_header);
+  }
+  if (lazy) {
+    // _ReadV caches the redirects it follows
+    HttPosixRedirectCache::Target target;
+    time_t expires = 0;
+    if (HttPosixRedirectCache::Lookup(HttPosixRedirectCache::Key(location.host, location.port, location.ssl, location.path), target, &expires)) {
+      redirection = Location(target.host, target.port, target.ssl, target.path);
+      redirection.cached = true;
+      location_validity = expires;
+      lazy = false;
+    }
+  }
+  return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+size_t HttPosixFile::Size()
+{
+  if (isopen && !size) {
+    std::lock_guard<std::mutex> mutx(mtx);
+    if (!size && !ReOpen()) {
+      Head();
+    }
+  }
+  return size;
+}
+
+/* -------------------------------------------------------------------------- */
+// HEAD request for the size when no response told it yet, follows redirects
+int HttPosixFile::Head()
+{
+  Location at = redirection;
+  httplib::Headers hd = request_header;
+  auto range = hd.equal_range("Range");
+  hd.erase(range.first, range.second);
+  for (int hop = 0; hop < REDIRECT_MAX_HOPS; ++hop) {
+    auto cli = HttPosix::Client(at.host, at.port, at.ssl);
+    res = cli->Head(at.path, hd);
+    if (!res || (res->status >= 400)) {
+      RedirectFailed(at);
+    }
+    if (!res) {
+      return -1;
+    }
+    if ((res->status > 300) && (res->status < 400) && res->has_header("Location")) {
+      HttPosixRedirectCache::Target from, target;
+      from.host = at.host;
+      from.port = at.port;
+      from.ssl = at.ssl;
+      from.path = at.path;
+      time_t expires = 0;
+      if (!HttPosixRedirectCache::Store(HttPosixRedirectCache::Key(at.host, at.port, at.ssl, at.path), from, res.value(), target, &expires)) {
+	std::cerr << "[open]: received invalid redirection URL : '" << res->get_header_value("Location") << "'" << std::endl;
 	return -1;
       }
-      isopen = true;
-      return 0;
-    } else {
-      location_validity = 0;
-      redirection = location;
-      isopen = true;
-      if (debug) {
-	std::cerr << "[debug] redirection.host     : " << redirection.host << std::endl;
-	std::cerr << "[debug] redirection.port     : " << redirection.port << std::endl;
-	std::cerr << "[debug] redirection.ssl      : " << redirection.ssl  << std::endl;
-	std::cerr << "[debug] redirection.path     : " << redirection.path << std::endl;
-	std::cerr << "[debug] redirection.validity : unlimited" << std::endl;
+      at = Location(target.host, target.port, target.ssl, target.path);
+      at.cached = true;
+      if (lazy) {
+	redirection = at;
+	location_validity = expires ? expires : 1;
+	lazy = false;
       }
-      return 0;
+      continue;
+    }
+    response_header = res->headers;
+    if (res->status != httplib::StatusCode::OK_200) {
+      return -1;
     }
+    size = res->get_header_value_u64("Content-Length");
+    return 0;
   }
   return -1;
 }
 
+/* -------------------------------------------------------------------------- */
+void HttPosixFile::RedirectFailed(const Location& loc)
+{
+  if (!loc.cached) {
+    return;
+  }
+  if (debug) {
+    std::cerr << "[debug] redirection.failed   : " << loc.host << ":" << loc.port << loc.path << std::endl;
+  }
+  HttPosixRedirectCache::Invalidate(HttPosixRedirectCache::Key(location.host, location.port, location.ssl, location.path));
+  // expired, the next ReOpen resolves the redirection again
+  location_validity = 1;
+}
+
+/* -------------------------------------------------------------------------- */
+// decides whether the disk cache holds the current version of the object, 'resp'
+// is the answer to the probe or nullptr if the final location still has to be asked
+void HttPosixFile::DiskValidate(const httplib::Response* resp)
+{
+  disk_valid = false;
+  if (!disk) {
+    return;
+  }
+  disk_key = HttPosixRedirectCache::Key(location.host, location.port, location.ssl, location.path);
+  HttDiskCache::Validator cached;
+  bool have = disk->GetValidator(disk_key, cached);
+  httplib::Result probe;
+  if (!resp) {
+    auto cli = HttPosix::Client(redirection.host, redirection.port, redirection.ssl);
+    httplib::Headers hd = request_header;
+    auto range = hd.equal_range("Range");
+    hd.erase(range.first, range.second);
+    hd.insert({"Range", "bytes=0-0"});
+    if (have) {
+      diskConditional(hd, cached);
+    }
+    probe = cli->Get(redirection.path, hd);
+    if (!probe) {
+      return;
+    }
+    resp = &probe.value();
+  }
+  if (have && (resp->status == httplib::StatusCode::NotModified_304)) {
+    disk_validator = cached;
+    size = cached.size;
+    disk_valid = true;
+  } else if (resp->status == httplib::StatusCode::PartialContent_206) {
+    // chunks are fetched with ranges, without range support nothing is cached
+    disk_validator = diskValidator(*resp, contentRangeTotal(*resp));
+    if (disk_validator.size && (!disk_validator.etag.empty() || !disk_validator.last_modified.empty())) {
+      size = disk_validator.size;
+      disk->SetValidator(disk_key, disk_validator);
+      disk_valid = true;
+    }
+  }
+  if (debug) {
+    std::cerr << "[debug] diskcache.valid      : " << disk_valid << std::endl;
+  }
+}
+
+/* -------------------------------------------------------------------------- */
+int HttPosixFile::_DiskRead(const Location& loc, const httplib::Headers& header, const std::string& key,
+			    const HttDiskCache::Validator& v, char* buffer, off_t offset, size_t len, httplib::Result& result)
+{
+  if ((size_t)offset >= v.size) {
+    return 0;
+  }
+  len = std::min(len, v.size - offset);
+  size_t cs = disk->ChunkSize();
+  std::vector<char> chunk;
+  size_t done = 0;
+  while (done < len) {
+    off_t pos = offset + done;
+    size_t index = pos / cs;
+    size_t in = pos % cs;
+    size_t n = std::min(len - done, cs - in);
+    if (disk->ReadChunk(key, index, buffer + done, n, in) == (ssize_t)n) {
+      done += n;
+      continue;
+    }
+    // miss, the whole chunk is fetched so it can be stored
+    off_t start = index * cs;
+    size_t clen = std::min(cs, v.size - start);
+    chunk.resize(clen);
+    std::vector<HttPosixReadVec> vec = {{start, clen, chunk.data(), 0}};
+    int rc = _ReadV(loc, header, {{start, (off_t)(start + clen - 1)}}, vec, result);
+    if (rc < 0) {
+      return done ? (int)done : rc;
+    }
+    if (result && diskStale(result.value(), v)) {
+      // changed on the server since Open, the cached chunks are of no use any more
+      disk->Invalidate(key);
+      disk_valid = false;
+    } else if (vec[0].bytes == clen) {
+      disk->WriteChunk(key, index, chunk.data(), clen);
+    }
+    if (vec[0].bytes <= in) {
+      break;
+    }
+    n = std::min(n, vec[0].bytes - in);
+    memcpy(buffer + done, chunk.data() + in, n);
+    done += n;
+    if (vec[0].bytes < clen) {
+      // short answer, don't ask again for the rest of it
+      break;
+    }
+  }
+  return done;
+}
 
 /* -------------------------------------------------------------------------- */
 int HttPosixFile::Close()
@@ -290,44 +2438,178 @@ int HttPosixFile::Close()
   if (debug) {
     std::cerr << "[debug] Close [" << location.host << ":" << location.port << "{" << (location.ssl?std::string("https"):std::string("http")) <<  "} ]"<< std::endl;
   }
+  {
+    // the reads use this object until they complete
+    std::unique_lock<std::mutex> lock(async_mtx);
+    async_cv.wait(lock, [this] { return !async_pending; });
+  }
   std::lock_guard<std::mutex> mutx(mtx);
+  // waits for prefetches still in flight
+  Evict(true);
   return 0;
 }
 
-// Function to split a string by a delimiter
-std::vector<std::string> split(const std::string& str, const std::string& delimiter) {
-  std::vector<std::string> parts;
-  size_t start = 0;
-  size_t end = str.find(delimiter);
-  while (end != std::string::npos) {
-    parts.push_back(str.substr(start, end - start));
-    start = end + delimiter.length();
-    end = str.find(delimiter, start);
+// Incremental multipart/byteranges parser, fed from a content receiver.
+// Every part is located by its Content-Range and copied straight to its
+// place in the scatter list, nothing of the body is buffered.
+class ByteRangesParser {
+public:
+  ByteRangesParser(const std::string& boundary, std::vector<HttPosixReadVec>& scatter)
+    : delimiter("\r\n--" + boundary), scatter(scatter) {}
+
+  // multipart/byteranges; boundary=<boundary>, empty if the type does not match
+  static std::string Boundary(const std::string& content_type) {
+    if (content_type.compare(0, 20, "multipart/byteranges")) {
+      return "";
+    }
+    auto pos = content_type.find("boundary=");
+    if (pos == std::string::npos) {
+      return "";
+    }
+    std::string boundary = content_type.substr(pos + 9);
+    boundary = boundary.substr(0, boundary.find(';'));
+    if ((boundary.size() >= 2) && (boundary.front() == '"') && (boundary.back() == '"')) {
+      boundary = boundary.substr(1, boundary.size() - 2);
+    }
+    return boundary;
+  }
+
+  // a returned range has to overlap what was asked for and fit the object size
+  static bool Valid(const std::vector<HttPosixReadVec>& scatter, const std::string& content_range) {
+    unsigned long long first, last, total;
+    int n = sscanf(content_range.c_str(), " bytes %llu-%llu/%llu", &first, &last, &total);
+    if ((n < 2) || (last < first) || ((n == 3) && (last >= total))) {
+      return false;
+    }
+    for (auto& r : scatter) {
+      if (((off_t)first < (off_t)(r.offset + r.length)) && ((off_t)last >= r.offset)) {
+	return true;
+      }
+    }
+    return false;
   }
-  parts.push_back(str.substr(start, end));
-  return parts;
-}
 
-// Function to parse the multipart/byteranges body
-std::string parseMultipartByteranges(const std::string& body, const std::string& boundary) {
-  std::string filtered_body;
-  std::vector<std::string> parts = split(body, "--" + boundary);
-  
-  for (const auto& part : parts) {
-    // Ignore the empty parts and the final boundary part
-    if (part.empty() || part == "--") continue;
-    // Find the header/body separator
-    size_t header_end = part.find("\n\n");
-    if (header_end != std::string::npos) {
-      // Extract the body part after the headers
-      std::string content = part.substr(header_end + 2);
-      content.pop_back();
-      filtered_body += content;
+  // copies [offset, offset+len) of the object to every scatter range it overlaps
+  static void Scatter(std::vector<HttPosixReadVec>& scatter, off_t offset, const char* data, size_t len) {
+    for (auto& r : scatter) {
+      off_t lo = std::max(offset, r.offset);
+      off_t hi = std::min((off_t)(offset + len), (off_t)(r.offset + r.length));
+      if (lo < hi) {
+	memcpy((char*)r.buffer + (lo - r.offset), data + (lo - offset), hi - lo);
+	r.bytes += hi - lo;
+      }
     }
   }
-  
-  return filtered_body;
-}
+
+  bool Feed(const char* data, size_t len) {
+    const char* end = data + len;
+    while (data < end) {
+      switch (state) {
+      case BODY:
+	if (!matched) {
+	  // everything up to the next CR is content
+	  const char* cr = (const char*)memchr(data, '\r', end - data);
+	  const char* stop = cr ? cr : end;
+	  Emit(data, stop - data);
+	  data = stop;
+	  if (cr) {
+	    matched = 1;
+	    data++;
+	  }
+	} else if (*data == delimiter[matched]) {
+	  data++;
+	  if (++matched == delimiter.size()) {
+	    matched = 0;
+	    state = AFTER_DELIMITER;
+	    line.clear();
+	  }
+	} else {
+	  // a false start of the delimiter is content, CR only starts the delimiter
+	  Emit(delimiter.data(), matched);
+	  matched = 0;
+	}
+	break;
+      case AFTER_DELIMITER:
+	// '--' closes the multipart body, anything else up to LF is padding
+	line += *data++;
+	if (line == "--") {
+	  state = DONE;
+	} else if (line.back() == '\n') {
+	  state = HEADERS;
+	  line.clear();
+	  inpart = false;
+	} else if (line.size() > 1024) {
+	  return false;
+	}
+	break;
+      case HEADERS:
+	line += *data++;
+	if (line.back() == '\n') {
+	  if ((line == "\r\n") || (line == "\n")) {
+	    if (!inpart) {
+	      // a part without Content-Range can't be placed
+	      return false;
+	    }
+	    state = BODY;
+	  } else if (!ParseHeader(line)) {
+	    return false;
+	  }
+	  line.clear();
+	} else if (line.size() > 8192) {
+	  return false;
+	}
+	break;
+      case DONE:
+	// epilogue
+	return true;
+      }
+    }
+    return true;
+  }
+
+  bool Done() const { return state == DONE; }
+
+private:
+  enum State { BODY, AFTER_DELIMITER, HEADERS, DONE };
+
+  bool ParseHeader(const std::string& header) {
+    if (strncasecmp(header.c_str(), "Content-Range:", 14)) {
+      return true;
+    }
+    unsigned long long first, last;
+    if (!Valid(scatter, header.substr(14)) ||
+	(sscanf(header.c_str() + 14, " bytes %llu-%llu", &first, &last) != 2)) {
+      return false;
+    }
+    part_offset = first;
+    part_length = last - first + 1;
+    position = 0;
+    inpart = true;
+    return true;
+  }
+
+  void Emit(const char* data, size_t len) {
+    if (!inpart || (state != BODY)) {
+      // preamble or data of an unknown part
+      return;
+    }
+    // never beyond what the part's Content-Range announced
+    len = std::min(len, part_length - position);
+    Scatter(scatter, part_offset + position, data, len);
+    position += len;
+  }
+
+  std::string delimiter;
+  std::vector<HttPosixReadVec>& scatter;
+  // the body starts with '--<boundary>', pretend the CRLF was seen already
+  State state = BODY;
+  size_t matched = 2;
+  std::string line;
+  bool inpart = false;
+  off_t part_offset = 0;
+  size_t part_length = 0;
+  size_t position = 0;
+};
 
 // Function to print a hex dump of a string
 void hexDump(const std::string& data) {
@@ -369,16 +2651,136 @@ void hexDump(const std::string& data) {
 
 /* -------------------------------------------------------------------------- */
 int HttPosixFile::ReadV(const httplib::Ranges& ranges, void* buffer)
+{
+  std::vector<HttPosixReadVec> vec;
+  size_t off = 0;
+  for (auto& r : ranges) {
+    if ((r.first < 0) || (r.second < r.first)) {
+      return -EINVAL;
+    }
+    size_t len = r.second - r.first + 1;
+    vec.push_back(HttPosixReadVec{r.first, len, (char*)buffer + off, 0});
+    off += len;
+  }
+  return ReadV(vec);
+}
+
+/* -------------------------------------------------------------------------- */
+int HttPosixFile::ReadV(std::vector<HttPosixReadVec>& vec)
 {
   if (debug) {
-    std::cerr << "[debug] ReadV [" << location.host << ":" << location.port << "{" << (location.ssl?std::string("https"):std::string("http")) << " } ] ranges:[" << ranges.size() << "]" <<std::endl;
+    std::cerr << "[debug] ReadV [" << location.host << ":" << location.port << "{" << (location.ssl?std::string("https"):std::string("http")) << " } ] ranges:[" << vec.size() << "]" <<std::endl;
   }
   std::lock_guard<std::mutex> mutx(mtx);
   auto rc = ReOpen();
   if (rc) {
     return rc;
   }
-  httplib::Headers hd = request_header;
+
+  std::vector<size_t> order;
+  for (size_t i = 0; i < vec.size(); ++i) {
+    if ((vec[i].offset < 0) || !vec[i].length || !vec[i].buffer) {
+      return -EINVAL;
+    }
+    vec[i].bytes = 0;
+    order.push_back(i);
+  }
+  if (order.empty()) {
+    return 0;
+  }
+
+  // merge ranges in offset order when the gap between them is small, the
+  // over-read bytes are simply not copied anywhere
+  std::sort(order.begin(), order.end(), [&](size_t x, size_t y) { return vec[x].offset < vec[y].offset; });
+  struct Span {
+    off_t first;
+    off_t last;
+    std::vector<size_t> members;
+  };
+  std::vector<Span> spans;
+  for (auto i : order) {
+    off_t last = vec[i].offset + vec[i].length - 1;
+    if (spans.empty() || (vec[i].offset > spans.back().last + (off_t)merge_gap + 1)) {
+      spans.push_back(Span{vec[i].offset, last, {}});
+    }
+    spans.back().last = std::max(spans.back().last, last);
+    spans.back().members.push_back(i);
+  }
+
+  // at most max_ranges ranges per request
+  struct Batch {
+    httplib::Ranges ranges;
+    std::vector<size_t> members;
+    std::vector<HttPosixReadVec> vec;
+    httplib::Result result;
+    int rc = 0;
+  };
+  std::vector<Batch> batches((spans.size() + max_ranges - 1) / max_ranges);
+  for (size_t k = 0; k < spans.size(); ++k) {
+    auto& batch = batches[k / max_ranges];
+    batch.ranges.push_back({spans[k].first, spans[k].last});
+    for (auto i : spans[k].members) {
+      batch.members.push_back(i);
+      batch.vec.push_back(vec[i]);
+    }
+  }
+  if (debug) {
+    std::cerr << "[debug] ReadV plan: " << vec.size() << " ranges -> " << spans.size() << " ranges in " << batches.size() << " requests" << std::endl;
+  }
+
+  auto run = [&](Batch& batch) {
+    batch.rc = _ReadV(redirection, request_header, batch.ranges, batch.vec, batch.result);
+  };
+  if (batches.size() == 1) {
+    run(batches[0]);
+  } else {
+    // requests go out in parallel over pooled connections
+    std::atomic<size_t> next(0);
+    std::vector<std::future<void>> workers;
+    for (size_t w = 0; w < std::min(parallel, batches.size()); ++w) {
+      workers.emplace_back(std::async(std::launch::async, [&]() {
+	for (size_t k; (k = next++) < batches.size();) {
+	  run(batches[k]);
+	}
+      }));
+    }
+    for (auto& w : workers) {
+      w.wait();
+    }
+  }
+
+  int bytes = 0;
+  rc = 0;
+  for (auto& batch : batches) {
+    for (size_t m = 0; m < batch.members.size(); ++m) {
+      vec[batch.members[m]].bytes = batch.vec[m].bytes;
+    }
+    if (!rc) {
+      // the first failure is the one reported
+      res = std::move(batch.result);
+    }
+    if (batch.rc < 0) {
+      rc = batch.rc;
+    } else {
+      bytes += batch.rc;
+    }
+  }
+  return rc ? rc : bytes;
+}
+
+/* -------------------------------------------------------------------------- */
+void HttPosixFile::SetReadVPlan(size_t merge_gap, size_t max_ranges, size_t parallel)
+{
+  std::lock_guard<std::mutex> mutx(mtx);
+  this->merge_gap = merge_gap;
+  this->max_ranges = max_ranges ? max_ranges : 1;
+  this->parallel = parallel ? parallel : 1;
+}
+
+/* -------------------------------------------------------------------------- */
+int HttPosixFile::_ReadV(const Location& loc, const httplib::Headers& header, const httplib::Ranges& ranges, std::vector<HttPosixReadVec>& vec, httplib::Result& result, int hops)
+{
+  httplib::Headers hd = header;
 
   // rewrite the range header
   auto range = hd.equal_range("Range");
@@ -391,131 +2793,375 @@ int HttPosixFile::ReadV(const httplib::Ranges& ranges, void* buffer)
     }
   }
   
-  auto cli = HttPosix::Client(redirection.host, redirection.port, redirection.ssl);
-
-  //  std::cerr << "redirection host: " << redirection.host << redirection.port << ":" << redirection.path << std::endl;
-  off_t off=0;
-  /*
-  auto res = cli->Get(
-		      redirection.path,
-		      request_header,
-		      [&](const httplib::Response &resp) {
-			if (0) {
-			  std::cerr << "Response: " << resp.status << std::endl;
-			}
-			this->res.value() = resp;
-			if (resp.status != httplib::StatusCode::PartialContent_206) {
-			  return false;
-			}
-			return true; // return 'false' if you want to cancel the request.
-		      },
-		      [&](const char *data, size_t data_length) {
-			std::cerr << "[write] " << data_length << " offset: " << off <<std::endl;
-			memcpy((char*)buffer+off, data, data_length);
-			std::cerr << "recv: " << data_length << std::endl;
-			std::string s(data,data_length);
-			hexDump(s);
-					       
-			off += data_length;
-			return true; // return 'false' if you want to cancel the request.
-		      });
-  */
-  auto res = cli->Get(redirection.path, hd);
-  if (res) {
-    std::string filtered_body;
-    if (res->body.size()) {
-      std::string boundaryKey = "boundary=";
-      std::string boundary;
-      std::string header = res->get_header_value("Content-Type");
+  auto cli = HttPosix::Client(loc.host, loc.port, loc.ssl);
 
-      if (header.empty()) {
-	return -1;
+  // the body is parsed as it arrives, depending on what the server answered:
+  // a multipart/byteranges body, a single range or the complete object
+  std::unique_ptr<ByteRangesParser> parser;
+  off_t position = -1;
+  off_t end = 0;
+  for (auto& r : vec) {
+    end = std::max(end, (off_t)(r.offset + r.length));
+  }
+  bool failed = false;
+  bool complete = false;
+  bool redirected = false;
+  httplib::Response head;
+  result = cli->Get(
+		 loc.path,
+		 hd,
+		 [&](const httplib::Response &resp) {
+		   head = resp;
+		   if ((resp.status > 300) && (resp.status < 400) && resp.has_header("Location")) {
+		     // opened lazily or the cached redirection went stale
+		     redirected = true;
+		   } else if (resp.status == httplib::StatusCode::PartialContent_206) {
+		     size_t total = contentRangeTotal(resp);
+		     if (total) {
+		       size = total;
+		     }
+		     std::string boundary = ByteRangesParser::Boundary(resp.get_header_value("Content-Type"));
+		     if (!boundary.empty()) {
+		       parser.reset(new ByteRangesParser(boundary, vec));
+		     } else {
+		       std::string crange = resp.get_header_value("Content-Range");
+		       unsigned long long first;
+		       if (!ByteRangesParser::Valid(vec, crange) ||
+			   (sscanf(crange.c_str(), "bytes %llu-", &first) != 1)) {
+			 failed = true;
+			 return false;
+		       }
+		       position = first;
+		     }
+		   } else if (resp.status == httplib::StatusCode::OK_200) {
+		     // ranges ignored, the object starts at 0
+		     position = 0;
+		   }
+		   return true; // error bodies are received and dropped
+		 },
+		 [&](const char *data, size_t data_length) {
+		   if (parser) {
+		     if (!parser->Feed(data, data_length)) {
+		       failed = true;
+		       return false;
+		     }
+		   } else if (position >= 0) {
+		     ByteRangesParser::Scatter(vec, position, data, data_length);
+		     position += data_length;
+		     if (position >= end) {
+		       // don't download the rest of an ignored or too generous range
+		       complete = true;
+		       return false;
+		     }
+		   }
+		   return true; // return 'false' if you want to cancel the request.
+		 });
+
+  if ((!result && !complete && !failed) ||
+      (result && (result->status >= 400) &&
+       (result->status != httplib::StatusCode::PreconditionFailed_412) &&
+       (result->status != httplib::StatusCode::RangeNotSatisfiable_416))) {
+    // the target did not serve the object, 412 and 416 are answers about the request
+    RedirectFailed(loc);
+  }
+
+  if (result && (result->status == httplib::StatusCode::PreconditionFailed_412)) {
+    // the object changed since it was stat'ed
+    HttPosixStatCache::Invalidate(HttPosixRedirectCache::Key(location.host, location.port, location.ssl, location.path));
+    if_match_failed = true;
+  }
+
+  if (result && redirected) {
+    HttPosixRedirectCache::Target from, target;
+    from.host = loc.host;
+    from.port = loc.port;
+    from.ssl = loc.ssl;
+    from.path = loc.path;
+    if ((hops + 1 >= REDIRECT_MAX_HOPS) ||
+	!HttPosixRedirectCache::Store(HttPosixRedirectCache::Key(loc.host, loc.port, loc.ssl, loc.path), from, result.value(), target)) {
+      return -1;
+    }
+    Location next(target.host, target.port, target.ssl, target.path);
+    // just cached, dropped again if the target fails
+    next.cached = true;
+    return _ReadV(next, header, ranges, vec, result, hops + 1);
+  }
+
+  if (result && (result->status == httplib::StatusCode::RangeNotSatisfiable_416)) {
+    // some servers refuse ranges reaching past the end instead of clipping them,
+    // retry with what exists according to 'Content-Range: bytes */<size>'
+    size_t total = contentRangeTotal(result.value());
+    if (!total) {
+      // not every server tells, fall back to what was seen before
+      total = size;
+    }
+    if (!total) {
+      // or ask, a lazily opened file hasn't seen anything yet
+      httplib::Headers hd = header;
+      auto range = hd.equal_range("Range");
+      hd.erase(range.first, range.second);
+      auto head = cli->Head(loc.path, hd);
+      if (head && (head->status == httplib::StatusCode::OK_200) && head->has_header("Content-Length")) {
+	total = head->get_header_value_u64("Content-Length");
+	size = total;
       }
-      if (header == "multipart/byteranges") {
-	// Find the position of "boundary="
-	size_t pos = header.find(boundaryKey);
-	if (pos != std::string::npos) {
-	  // Extract the boundary value
-	  boundary = header.substr(pos + boundaryKey.length());
-	} else {
-	  return -1;
-	}
-	filtered_body = parseMultipartByteranges(res->body, boundary);
-	memcpy(buffer, filtered_body.c_str(), filtered_body.size());
-	if (debug ) {
-	  std::cerr << "[debug] returned body size:" << filtered_body.size() << std::endl;
-	}
-	return filtered_body.size();
-      } else {
-	memcpy(buffer, res->body.c_str(), res->body.size());
-	if (debug ) {
-	  std::cerr << "[debug] returned body size:" << res->body.size() << std::endl;
+    }
+    if (total) {
+      httplib::Ranges clipped;
+      for (auto& r : ranges) {
+	if (r.first < (ssize_t)total) {
+	  clipped.push_back({r.first, std::min(r.second, (ssize_t)total - 1)});
 	}
-	return res->body.size();
+      }
+      if (clipped.empty()) {
+	// all of it is beyond the end
+	return 0;
+      }
+      if (clipped != ranges) {
+	return _ReadV(loc, header, clipped, vec, result, hops);
       }
     }
-    return -1;
-  } else {
+  }
+
+  if (!result && complete && (result.error() == httplib::Error::Canceled)) {
+    // cut short on purpose, keep the response for Result()
+    result = httplib::Result(std::make_unique<httplib::Response>(head), httplib::Error::Success);
+  }
+
+  if (!result || failed || (!parser && (position < 0))) {
+    if (debug) {
+      std::cerr << "[debug] ReadV failed" << (failed ? " : invalid Content-Range or multipart body" : "") << std::endl;
+    }
     return -1;
   }
-  
+
+  size_t bytes = 0;
+  for (auto& r : vec) {
+    // overlapping parts deliver some bytes twice
+    r.bytes = std::min(r.bytes, r.length);
+    bytes += r.bytes;
+  }
+  if (debug) {
+    std::cerr << "[debug] returned body size:" << bytes << std::endl;
+  }
+  return bytes;
 }
 
 /* -------------------------------------------------------------------------- */
-int HttPosixFile::Read(char* buffer, off_t offset, size_t len)
+void HttPosixFile::SetCache(size_t max_bytes, size_t block_size, size_t readahead)
 {
-  if (debug) {
-    std::cerr << "[debug] Read [" << location.host << ":" << location.port << "{" << (location.ssl?std::string("https"):std::string("http")) << "} ] " << "{" << offset << "," << len << "}" << std::endl;
-  }  
   std::lock_guard<std::mutex> mutx(mtx);
-  int rc = ReOpen();
-  if (rc) {
-    return rc;
+  Evict(true);
+  cache_max = max_bytes;
+  cache_block = block_size ? block_size : CACHE_BLOCK_SIZE;
+  cache_readahead = readahead;
+}
+
+/* -------------------------------------------------------------------------- */
+HttPosixFile::CacheEntry&
+HttPosixFile::Fetch(off_t b)
+{
+  auto it = cache.find(b);
+  if (it != cache.end()) {
+    cache_lru.splice(cache_lru.begin(), cache_lru, it->second.lru);
+    return it->second;
   }
+  // the fetch works on copies, ReOpen may change the location meanwhile
+  auto block = std::make_shared<Block>();
+  Location loc = redirection;
   httplib::Headers hd = request_header;
+  size_t len = cache_block;
+  bool from_disk = disk_valid;
+  std::string key = disk_key;
+  HttDiskCache::Validator v = disk_validator;
+  auto ready = std::async(std::launch::async, [this, block, loc, hd, b, len, from_disk, key, v]() {
+    block->data.resize(len);
+    httplib::Result result;
+    if (from_disk) {
+      block->rc = _DiskRead(loc, hd, key, v, block->data.data(), b, len, result);
+      block->length = std::max(block->rc, 0);
+      return;
+    }
+    std::vector<HttPosixReadVec> vec = {{b, len, block->data.data(), 0}};
+    block->rc = _ReadV(loc, hd, {{b, b + len - 1}}, vec, result);
+    block->length = vec[0].bytes;
+  }).share();
+  cache_lru.push_front(b);
+  return cache[b] = CacheEntry{block, ready, cache_lru.begin()};
+}
 
-  // rewrite the range header
-  auto range = hd.equal_range("Range");
-  hd.erase(range.first, range.second);
-  std::string request = std::string("bytes=") + std::to_string(offset) + std::string("-") + std::to_string(offset+len);
+/* -------------------------------------------------------------------------- */
+void HttPosixFile::Evict(bool all)
+{
+  auto it = cache_lru.end();
+  while ((it != cache_lru.begin()) && (all || (cache.size() * cache_block > cache_max))) {
+    --it;
+    auto entry = cache.find(*it);
+    if (!all && (entry->second.ready.wait_for(std::chrono::seconds(0)) != std::future_status::ready)) {
+      // still being fetched, dropping it would wait for it
+      continue;
+    }
+    cache.erase(entry);
+    it = cache_lru.erase(it);
+  }
+}
 
-  hd.insert({"Range", request});
+/* -------------------------------------------------------------------------- */
+int HttPosixFile::CachedRead(char* buffer, off_t offset, size_t len)
+{
+  sequential = (offset == last_end) ? sequential + 1 : 0;
+  last_end = offset + len;
+  if (!len) {
+    return 0;
+  }
 
-  if (debug) {
-    for (auto i:hd) {
-      std::cerr << "[debug]" << std::setw(24) << std::left << i.first << ": " << i.second  << std::endl;
+  off_t end = offset + len;
+  off_t first_block = offset / cache_block * cache_block;
+  off_t last_block = (end - 1) / cache_block * cache_block;
+  bool cached = true;
+  for (off_t b = first_block; cached && (b <= last_block); b += cache_block) {
+    cached = cache.count(b);
+  }
+  if (!sequential && !cached) {
+    // random access, fetch exactly what was asked for
+    if (disk_valid) {
+      return _DiskRead(redirection, request_header, disk_key, disk_validator, buffer, offset, len, res);
     }
+    std::vector<HttPosixReadVec> vec = {{offset, len, buffer, 0}};
+    return _ReadV(redirection, request_header, {{offset, end - 1}}, vec, res);
   }
-  auto cli = HttPosix::Client(redirection.host, redirection.port, redirection.ssl);
 
+  // read-ahead first so it overlaps with waiting for the blocks needed now
+  if (sequential) {
+    for (size_t k = 1; k <= cache_readahead; ++k) {
+      off_t b = last_block + k * cache_block;
+      if (size && ((size_t)b >= size)) {
+	// past the end of the object, the server would answer 416
+	break;
+      }
+      Fetch(b);
+    }
+  }
+
+  size_t done = 0;
+  for (off_t b = first_block; b <= last_block; b += cache_block) {
+    auto& entry = Fetch(b);
+    entry.ready.wait();
+    auto block = entry.block;
+    if (block->rc < 0) {
+      // don't keep the failure
+      cache_lru.erase(entry.lru);
+      cache.erase(b);
+      return done ? (int)done : block->rc;
+    }
+    size_t from = std::max(offset, b) - b;
+    if (from >= block->length) {
+      break;
+    }
+    size_t n = std::min(block->length - from, (size_t)(end - b) - from);
+    memcpy(buffer + done, block->data.data() + from, n);
+    done += n;
+    if (block->length < cache_block) {
+      // end of the object
+      break;
+    }
+  }
+  Evict();
+  return done;
+}
+
+/* -------------------------------------------------------------------------- */
+int HttPosixFile::Read(char* buffer, off_t offset, size_t len)
+{
   if (debug) {
-    std::cerr << "[debug] redirection host: " << redirection.host << redirection.port << ":" << redirection.path << std::endl;
+    std::cerr << "[debug] Read [" << location.host << ":" << location.port << "{" << (location.ssl?std::string("https"):std::string("http")) << "} ] " << "{" << offset << "," << len << "}" << std::endl;
+  }  
+  std::lock_guard<std::mutex> mutx(mtx);
+  int rc = ReOpen();
+  if (rc) {
+    return rc;
   }
-  off_t off=0;
-  res = cli->Get(
-		 redirection.path,
-		 request_header,
-		 [&](const httplib::Response &resp) {
-		   if (0) {
-		     std::cerr << "Response: " << resp.status << std::endl;
-		   }
-		   this->res.value() = resp;
-		   if (resp.status != httplib::StatusCode::PartialContent_206) {
-		     return false;
-		   }
-		   return true; // return 'false' if you want to cancel the request.
-		 },
-		 [&](const char *data, size_t data_length) {
-		   // std::cerr << "[write] " << data_length << " offset: " << off <<std::endl;
-		   memcpy((char*)buffer+off, data, data_length);
-		   // std::cerr << "recv: " << data_length << std::endl;
-		   off += data_length;
-			return true; // return 'false' if you want to cancel the request.
-		 });
+  if (cache_max) {
+    return CachedRead(buffer, offset, len);
+  }
+  if (disk_valid) {
+    return _DiskRead(redirection, request_header, disk_key, disk_validator, buffer, offset, len, res);
+  }
+  if (!len) {
+    return 0;
+  }
+  // 'bytes=<offset>-<offset+len-1>', at most len bytes reach the buffer and the
+  // transfer is aborted once they arrived, even if the server ignores the range
+  std::vector<HttPosixReadVec> vec = {{offset, len, buffer, 0}};
+  return _ReadV(redirection, request_header, {{offset, (off_t)(offset + len - 1)}}, vec, res);
+}
 
-  if (res) {
-    return off;
-  } else {
-    return -1;
+/* -------------------------------------------------------------------------- */
+// threads running ReadAsync; never destroyed, joining them at exit would wait for transfers
+static httplib::ThreadPool& asyncPool() {
+  static auto pool = []() {
+    // a pool without threads would never complete a read
+    const char* n = getenv("HTTPCPP_ASYNC_THREADS");
+    int threads = n ? atoi(n) : 0;
+    return new httplib::ThreadPool((threads >= 1) ? threads : ASYNC_READ_THREADS);
+  }();
+  return *pool;
+}
+
+/* -------------------------------------------------------------------------- */
+std::future<int> HttPosixFile::ReadAsync(char* buffer, off_t offset, size_t len, std::function<void(int)> callback)
+{
+  auto done = std::make_shared<std::promise<int>>();
+  auto ft = done->get_future();
+  {
+    std::lock_guard<std::mutex> lock(async_mtx);
+    ++async_pending;
+  }
+  bool queued = asyncPool().enqueue([this, buffer, offset, len, callback, done]() {
+    int rc = 0;
+    Location loc;
+    httplib::Headers hd;
+    bool from_disk;
+    std::string key;
+    HttDiskCache::Validator v;
+    {
+      // mtx only guards the snapshot, the transfer runs without it
+      std::lock_guard<std::mutex> mutx(mtx);
+      rc = ReOpen();
+      loc = redirection;
+      hd = request_header;
+      from_disk = disk_valid;
+      key = disk_key;
+      v = disk_validator;
+    }
+    if (debug) {
+      std::cerr << "[debug] ReadAsync [" << loc.host << ":" << loc.port << "] " << "{" << offset << "," << len << "}" << std::endl;
+    }
+    httplib::Result result;
+    if (!rc && len) {
+      if (from_disk) {
+	rc = _DiskRead(loc, hd, key, v, buffer, offset, len, result);
+      } else {
+	std::vector<HttPosixReadVec> vec = {{offset, len, buffer, 0}};
+	rc = _ReadV(loc, hd, {{offset, (off_t)(offset + len - 1)}}, vec, result);
+      }
+    }
+    if (callback) {
+      callback(rc);
+    }
+    done->set_value(rc);
+    std::lock_guard<std::mutex> lock(async_mtx);
+    --async_pending;
+    async_cv.notify_all();
+  });
+  if (!queued) {
+    if (callback) {
+      callback(-1);
+    }
+    done->set_value(-1);
+    std::lock_guard<std::mutex> lock(async_mtx);
+    --async_pending;
+    async_cv.notify_all();
   }
+  return ft;
 }
@@ -5,50 +5,261 @@
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <map>
+#include <vector>
+#include <memory>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <sys/stat.h>
+#include <openssl/x509.h>
 #include "ringbuffer.h"
+#include "httdiskcache.hh"
 /* -------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------- */
 #pragma once
 
 #define USE_RING_BUFFER 1
+#define PARALLEL_CHUNK_SIZE 4*1024*1024
+#define STREAM_SEEK_SKIP_SIZE 1*1024*1024  // forward seeks up to this distance discard data instead of restarting
+#define CLIENT_POOL_IDLE_TIMEOUT 10         // seconds an idle keep-alive connection is kept
+#define CLIENT_POOL_MAX_PER_HOST 16         // idle connections kept per scheme/host/port/TLS setting
+#define REDIRECT_CACHE_TTL 30               // seconds a redirect is cached without Cache-Control/Expires
+#define REDIRECT_CACHE_SIZE 4096            // redirect targets kept in the LRU
+#define REDIRECT_MAX_HOPS 10
+#define READV_MERGE_GAP 64*1024             // ranges closer than this are fetched as one range
+#define READV_MAX_RANGES 256                // ranges per request, servers cap the count and header size
+#define READV_PARALLEL 4                    // requests in flight when a ReadV needs several
+#define CACHE_BLOCK_SIZE 1*1024*1024        // block size of the HttPosixFile read cache
+#define CACHE_READAHEAD 4                   // blocks prefetched ahead of sequential reads
+#define ASYNC_READ_THREADS 64               // threads serving ReadAsync, shared by all files
+#define STAT_PARALLEL 16                    // HEAD requests in flight in StatMany
+#define DELETE_PARALLEL 16                  // DELETE requests in flight in DeleteMany
+#define STAT_CACHE_TTL 5                    // seconds a Stat result is cached
+#define STAT_CACHE_NEGATIVE_TTL 5           // seconds a 404/410 is cached
+#define STAT_CACHE_SIZE 65536               // Stat results kept in the LRU
+#define SENDFILE_CHUNK_SIZE 16*1024*1024    // bytes per sendfile call of a file upload
 
 /* -------------------------------------------------------------------------- */
 namespace httplib {
   class Response;
 }
 
+// Returns a client to HttPosixClientPool when the owning pointer goes away
+struct HttPosixClientReleaser {
+  std::string key;
+  void operator()(httplib::Client* cli) const;
+};
+using HttPosixClient = std::unique_ptr<httplib::Client, HttPosixClientReleaser>;
+
+// Process-wide pool of kept-alive clients keyed by scheme/host/port and TLS settings.
+// Idle clients are dropped after an idle timeout or when their socket died, and
+// at most 'max per host' idle clients are kept per key.
+class HttPosixClientPool {
+public:
+  // 'ktls' enables kernel TLS on new HTTPS clients, those are pooled separately
+  static HttPosixClient Get(const std::string& host, int port, bool ssl, bool ktls = false);
+  static void Put(const std::string& key, httplib::Client* cli);
+  static void SetIdleTimeout(time_t seconds);
+  static void SetMaxPerHost(size_t n);
+  static void Clear();
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+  // TLS sessions shared by all pooled clients, see hits()/misses() for resumption stats
+  static std::shared_ptr<httplib::SSLSessionCache> SessionCache();
+#endif
+
+private:
+  struct Idle {
+    std::unique_ptr<httplib::Client> cli;
+    time_t since;
+  };
+  static std::mutex mtx;
+  static std::map<std::string, std::vector<Idle>> idle;
+  static time_t idle_timeout;
+  static size_t max_per_host;
+
+  // CA bundle parsed once and shared by all clients, reloaded when the file changes
+  static X509_STORE* CaStore(const std::string& bundle);
+  static std::mutex ca_mtx;
+  static X509_STORE* ca_store;
+  static std::string ca_path;
+  static struct timespec ca_mtime;
+};
+
+// Process-wide LRU cache of redirect targets keyed by the original URL.
+// Entries expire according to Cache-Control max-age/Expires of the redirect
+// response, never later than the expiry of a signed target URL.
+class HttPosixRedirectCache {
+public:
+  struct Target {
+    std::string host;
+    int port = 0;
+    bool ssl = false;
+    std::string path;
+  };
+
+  static std::string Key(const std::string& host, int port, bool ssl, const std::string& path);
+  static bool Lookup(const std::string& key, Target& target, time_t* expires = nullptr);
+  // parses the Location of a 3xx response and caches it, returns false for an unusable Location
+  static bool Store(const std::string& key, const Target& from, const httplib::Response& resp, Target& target, time_t* expires = nullptr);
+  static void Invalidate(const std::string& key);
+  static void SetMaxEntries(size_t n);
+  static void SetDefaultTTL(time_t seconds);
+  static void Clear();
+
+private:
+  struct Entry {
+    Target target;
+    time_t expires;
+    std::list<std::string>::iterator lru;
+  };
+  static time_t Expiry(const httplib::Response& resp, const std::string& location);
+  static std::mutex mtx;
+  static std::list<std::string> lru;
+  static std::unordered_map<std::string, Entry> entries;
+  static size_t max_entries;
+  static time_t default_ttl;
+};
+
+// Result of one HEAD request of HttPosix::StatMany
+struct HttPosixStat {
+  int rc = 0;        // 0, or a negative errno mapped from the HTTP status or connection error
+  struct stat st = {};
+};
+
+// Process-wide cache of HEAD results keyed like HttPosixRedirectCache, so that
+// open/stat/read/stat sequences hit the network once. Successful answers live for
+// the TTL, 404/410 for the negative TTL; Delete, Mkdir and uploads drop the entry.
+// The strong ETag kept with an entry makes HttPosixFile reads conditional (If-Match).
+// Requests carrying credentials neither use nor fill it.
+class HttPosixStatCache {
+public:
+  struct Entry {
+    int status = 0;
+    struct stat st = {};
+    httplib::Headers headers;
+    time_t expires = 0;
+    std::list<std::string>::iterator lru;
+  };
+
+  static bool Lookup(const std::string& key, Entry& entry);
+  // caches successful and not-found responses, anything else drops the entry
+  static void Store(const std::string& key, const httplib::Response& resp, const struct stat& st);
+  // strong ETag of a cached successful response, empty if none
+  static std::string ETag(const std::string& key);
+  // false for requests with Authorization or Cookie headers, their answers aren't shared
+  static bool Cacheable(const httplib::Headers& request_hd);
+  static void Invalidate(const std::string& key);
+  static void SetMaxEntries(size_t n);
+  static void SetTTL(time_t seconds, time_t negative_seconds = STAT_CACHE_NEGATIVE_TTL);
+  static void Clear();
+
+private:
+  static std::mutex mtx;
+  static std::list<std::string> lru;
+  static std::unordered_map<std::string, Entry> entries;
+  static size_t max_entries;
+  static time_t ttl;
+  static time_t negative_ttl;
+};
+
+// One member of a directory listed by HttPosix::ListDir
+struct HttPosixDirEntry {
+  std::string name;    // last path segment
+  std::string path;    // decoded path on the server, collections end with '/'
+  std::string href;    // the same path percent-encoded as the server sent it, for requests
+  std::string etag;
+  struct stat st = {};
+};
+
 class HttPosix {
 public:
+  // HEAD request following redirects, 'buf' gets the size from Content-Length and
+  // the mtime from Last-Modified, it is left untouched unless the final status is 2xx;
+  // 'status' (if given) the final HTTP status.
+  // Answered from HttPosixStatCache when possible
   static httplib::Error Stat(const std::string host,
 		  int port,
 		  bool ssl,
 		  const std::string path,
 		  struct stat& buf,
 		  const httplib::Headers& request_hd,
-		  httplib::Headers& response_hd);
+		  httplib::Headers& response_hd,
+		  int* status = nullptr);
 
+  // Stat for many URLs with up to 'parallel' requests in flight over pooled connections,
+  // one result per URL in the same order
+  static std::vector<HttPosixStat> StatMany(const std::vector<std::string>& urls,
+					    const httplib::Headers& request_hd = httplib::Headers(),
+					    size_t parallel = STAT_PARALLEL);
+
+  // WebDAV MKCOL, 0 or a negative errno (-EEXIST if it exists, -ENOENT if the parent
+  // is missing, -ENOTSUP if the server has no MKCOL); with 'parents' missing parents
+  // are created as well and an existing collection is fine (-ENOTDIR for a file), like mkdir -p
   static int Mkdir(const std::string host,
 		   int port,
 		   bool ssl,
-		   const std::string path);
+		   const std::string path,
+		   bool parents = false,
+		   const httplib::Headers& request_hd = httplib::Headers());
 
+  // DELETE, 0 or a negative errno (-EIO if a collection was only partly deleted)
   static int Delete(const std::string host,
 		    int port,
 		    bool ssl,
-		    const std::string path);
+		    const std::string path,
+		    const httplib::Headers& request_hd = httplib::Headers());
+
+  // Delete for many URLs with up to 'parallel' requests in flight over pooled
+  // connections, one result per URL in the same order
+  static std::vector<int> DeleteMany(const std::vector<std::string>& urls,
+				     const httplib::Headers& request_hd = httplib::Headers(),
+				     size_t parallel = DELETE_PARALLEL);
 
-  static std::unique_ptr<httplib::Client> Client(const std::string host, int port, bool ssl);
+  // WebDAV PROPFIND with 'Depth: <depth>' (-1 for infinity), the multistatus body is parsed
+  // as it arrives and every entry handed to 'callback' (return false to stop). The listed
+  // collection itself is skipped unless depth is 0. With 'cache' the entries go into
+  // HttPosixStatCache as well, unless the request carries credentials. Returns 0 or a
+  // negative errno
+  static int ListDir(const std::string host,
+		     int port,
+		     bool ssl,
+		     const std::string path,
+		     const std::function<bool(const HttPosixDirEntry&)>& callback,
+		     int depth = 1,
+		     bool cache = true,
+		     const httplib::Headers& request_hd = httplib::Headers());
+
+  // ListDir collecting the entries
+  static int ListDir(const std::string host,
+		     int port,
+		     bool ssl,
+		     const std::string path,
+		     std::vector<HttPosixDirEntry>& entries,
+		     int depth = 1,
+		     bool cache = true,
+		     const httplib::Headers& request_hd = httplib::Headers());
+
+  // a kept-alive client from HttPosixClientPool, returned to the pool when released;
+  // 'ktls' asks for kernel TLS, used by file uploads going through SSL_sendfile
+  static HttPosixClient Client(const std::string host, int port, bool ssl, bool ktls = false);
 
 private:
 };
 
+struct ParallelGet;
+
 class HttPosixFileStreamer {
  public:
+  // ring_size is the initial per-stream ring capacity; a larger ring_size_max
+  // lets the ring grow with the observed bandwidth-delay product up to that cap
   int Open(const std::string host,
 	   int port,
 	   bool ssl,
 	   const std::string path,
-	   const httplib::Headers& request_header);
+	   const httplib::Headers& request_header,
+	   size_t ring_size = RING_BUFFER_SIZE,
+	   size_t ring_size_max = 0);
 
   int _Open(const std::string host,
 	   int port,
@@ -57,16 +268,38 @@ class HttPosixFileStreamer {
 	   const httplib::Headers& request_header);
   
   int Close();
+  // forward seeks within buffered data (or STREAM_SEEK_SKIP_SIZE) consume the ring,
+  // anything else restarts the transfer with a 'Range: bytes=<newoffset>-' request.
+  // A 200 answer is skipped up to newoffset; any other answer than a 206 starting
+  // there makes Read fail with ESPIPE. Seeking to the size just sets EOF
   off_t Seek(off_t newoffset);
+  // 0 at the end of the body; -1 with errno=EIO once the data received before a
+  // failed transfer has been read
   int Read(char* buffer, size_t len);
+  // non-blocking read: returns -1 with errno=EAGAIN if no data is buffered yet, EIO like Read
+  int TryRead(char* buffer, size_t len);
+  // pollable kernel fd: readable while data or EOF is pending, use TryRead to drain it
+  int Fd() { return ringfd!=-1 ? ringfd : pipefd[0]; }
+  // fetch objects supporting byte ranges over 'streams' connections in 'chunksize' pieces, call before Open
+  void SetParallel(size_t streams, size_t chunksize = PARALLEL_CHUNK_SIZE);
+  // disk cache: complete objects are streamed from disk once If-None-Match confirms them,
+  // full downloads are added to it. nullptr disables it, call before Open
+  void SetDiskCache(HttDiskCache* cache) { disk = cache; }
 
   HttPosixFileStreamer() {
     pipefd[0]=-1;
     pipefd[1]=-1;
     ringfd=-1;
     location = 0;
+    start_offset = 0;
     size = 0;
     ready = false;
+    cancel = false;
+    error = 0;
+    pget = nullptr;
+    parallel_streams = 1;
+    parallel_chunk = PARALLEL_CHUNK_SIZE;
+    disk = HttDiskCache::Default();
   }
   ~HttPosixFileStreamer() {
     Close();
@@ -95,18 +328,123 @@ private:
   std::unique_ptr<std::future<int>> ft;
   int pipefd[2];
   int ringfd;
+  RingBufferFDManager::Handle ringh;
   off_t location;
   std::shared_ptr<httplib::Response> response;
-  off_t offset;
   std::atomic<size_t> size;
+
+  // where the stream comes from, kept to restart it on Seek
+  std::string host;
+  int port;
+  bool ssl;
+  std::string path;
+  off_t start_offset;
+  std::atomic<bool> cancel;
+  std::atomic<int> error;   // errno of a failed transfer
+  ParallelGet* pget;        // the running parallel download, guarded by mtx
+  void Start();
+  void Stop();
   
   std::mutex mtx;
   std::condition_variable cv;
   bool ready;
+  size_t parallel_streams;
+  size_t parallel_chunk;
+  HttDiskCache* disk;
   httplib::Headers request_header;
   static int httpGet(const std::string& host, int port, bool ssl, const std::string& path, int fd, HttPosixFileStreamer* streamer );
 };
 
+// Streams an upload: Write copies into a ring which a background thread sends as
+// the body of a PUT, with Content-Length if the size is given to Open and chunked
+// otherwise. Write blocks while the ring is full, so a producer runs at memory
+// speed until the ring is filled and at the pace of the upload after that.
+// Regular files are better uploaded with OpenFile: the kernel sends them with
+// sendfile(2) (SSL_sendfile over kernel TLS) without copying them through the ring.
+// A server may answer and close the connection before the body is complete, so
+// processes using it should ignore SIGPIPE like httpc does.
+class HttPosixFileWriter {
+public:
+  // 'size' is the total length of the body if known, -1 for a chunked upload.
+  // Returns 0, the server is only contacted by the background thread
+  int Open(const std::string host,
+	   int port,
+	   bool ssl,
+	   const std::string path,
+	   const httplib::Headers& request_header,
+	   ssize_t size = -1,
+	   size_t ring_size = RING_BUFFER_SIZE);
+
+  // uploads 'size' bytes (-1: up to the end of the file) at 'offset' of the regular file 'fd',
+  // which has to stay open until Close; Write isn't used then. 0, or -1 with errno set
+  int OpenFile(const std::string host,
+	       int port,
+	       bool ssl,
+	       const std::string path,
+	       const httplib::Headers& request_header,
+	       int fd,
+	       off_t offset = 0,
+	       ssize_t size = -1);
+
+  // blocks while the ring is full, -1 with errno=EIO once the upload failed
+  ssize_t Write(const char* buffer, size_t len);
+  // body bytes handed to the connection so far
+  size_t Sent() { return sent; }
+  // true once the answer arrived or the upload failed, Close won't block then
+  bool Done() { return !ft || (ft->wait_for(std::chrono::seconds(0)) == std::future_status::ready); }
+  // ends the body and waits for the answer: the HTTP status of the PUT, or a negative
+  // errno if the transfer failed (-EIO if fewer bytes than announced were written)
+  int Close();
+  std::shared_ptr<httplib::Response> Response() { return response; }
+
+  HttPosixFileWriter() {
+    port = 0;
+    ssl = false;
+    size = -1;
+    file_fd = -1;
+    file_offset = 0;
+    sent = 0;
+    cancel = false;
+    failed = false;
+  }
+  // an upload which wasn't closed is aborted instead of committed
+  ~HttPosixFileWriter() {
+    if (ft) {
+      cancel = true;
+      if (ring) {
+	ring->set_eof();
+      }
+      ft->wait();
+    }
+  }
+
+private:
+  std::unique_ptr<RingBuffer> ring;
+  std::unique_ptr<std::future<int>> ft;
+  std::shared_ptr<httplib::Response> response;
+  std::string host;
+  int port;
+  bool ssl;
+  std::string path;
+  ssize_t size;
+  int file_fd;         // source of OpenFile, -1 when fed by Write
+  off_t file_offset;
+  std::atomic<size_t> sent;
+  httplib::Headers request_header;
+  std::atomic<bool> cancel;
+  std::atomic<bool> failed;
+  static int httpPut(HttPosixFileWriter* writer);
+};
+
+// One piece of a vectored read: 'length' bytes at 'offset' of the object go
+// to 'buffer', 'bytes' reports how many of them were delivered
+struct HttPosixReadVec {
+  off_t offset;
+  size_t length;
+  void* buffer;
+  size_t bytes;
+};
+
 class HttPosixFile {
 public:  
   int Open(const std::string host,
@@ -121,34 +459,57 @@ public:
 	    const std::string path,
 	    const httplib::Headers& request_header);
 
-  int ReOpen() {
-    if (isopen) {
-      if (!Valid()) {
-	return _Open(location.host, location.port, location.ssl, location.path, request_header);
-      } else {
-	return 0;
-      }
-    } else {
-      return -EINVAL;
-    }
-  }
+  // refreshes an expired redirection, or picks up one resolved by a request meanwhile
+  int ReOpen();
   
   int Close();
 
-  // vector reads
+  // vector reads, the ranges are returned back to back in 'buffer'
   int ReadV(const httplib::Ranges& ranges, void* buffer);
+  // vector reads, every range goes to its own buffer; returns the total number of bytes
+  int ReadV(std::vector<HttPosixReadVec>& vec);
+  // how ReadV plans requests: gap below which neighbouring ranges are merged,
+  // ranges per request and number of requests issued in parallel
+  void SetReadVPlan(size_t merge_gap, size_t max_ranges = READV_MAX_RANGES, size_t parallel = READV_PARALLEL);
+  // block cache for Read, up to max_bytes of aligned blocks in LRU order; sequential
+  // reads prefetch 'readahead' blocks, random reads bypass it. 0 disables the cache
+  void SetCache(size_t max_bytes, size_t block_size = CACHE_BLOCK_SIZE, size_t readahead = CACHE_READAHEAD);
+  // persistent chunk cache shared across processes, revalidated on Open; nullptr disables it.
+  // Defaults to HttDiskCache::Default(), call before Open
+  void SetDiskCache(HttDiskCache* cache) { disk = cache; }
   // normal reads
   int Read(char* buffer, off_t offset, size_t len);
+  // asynchronous reads, any number can be outstanding per file and each one runs
+  // on its own pooled connection. The result is what Read would return, passed to
+  // 'callback' on the I/O thread and then to the future. 'buffer' must stay valid
+  // until then. They bypass the block cache; Close waits for them
+  std::future<int> ReadAsync(char* buffer, off_t offset, size_t len, std::function<void(int)> callback = nullptr);
   HttPosixFile() {
+    debug = false;
     size = 0;
     isopen = false;
     location_validity=0;
+    merge_gap = READV_MERGE_GAP;
+    max_ranges = READV_MAX_RANGES;
+    parallel = READV_PARALLEL;
+    cache_max = 0;
+    cache_block = CACHE_BLOCK_SIZE;
+    cache_readahead = CACHE_READAHEAD;
+    last_end = 0;
+    sequential = 0;
+    disk = HttDiskCache::Default();
+    disk_valid = false;
+    async_pending = 0;
+    lazy = false;
+    if_match = false;
+    if_match_failed = false;
   }
   ~HttPosixFile() {
     Close();
   }
 
-  size_t Size() { return size;}
+  // object size, learned from the first response or with a HEAD request if none happened yet
+  size_t Size();
   bool Valid() {
     if (!location_validity) { return true; }
     return (location_validity > time(NULL));
@@ -163,6 +524,7 @@ public:
     int port;
     bool ssl;
     std::string path;
+    bool cached = false;   // resolved from HttPosixRedirectCache
   };
 
   std::atomic<bool> debug;
@@ -172,6 +534,9 @@ private:
   std::atomic<size_t> size;
   std::atomic<bool> isopen;
   std::atomic<time_t> location_validity;
+  std::atomic<bool> lazy;     // opened without a request, redirection is still the location itself
+  bool if_match;              // request_header got If-Match from the stat cache
+  std::atomic<bool> if_match_failed;   // ... and a read answered 412, ReOpen removes it
   std::mutex mtx;
   Location location;
   Location redirection;
@@ -179,5 +544,51 @@ private:
   httplib::Headers request_header;
   httplib::Headers response_header;
   httplib::Result res;
+
+  size_t merge_gap;
+  size_t max_ranges;
+  size_t parallel;
+  // one ranged request scattering into 'vec', redirects are followed and cached
+  int _ReadV(const Location& loc, const httplib::Headers& header, const httplib::Ranges& ranges, std::vector<HttPosixReadVec>& vec, httplib::Result& result, int hops = 0);
+  int Head();
+  // a request to the cache-derived 'loc' failed: drop the entry and resolve again on ReOpen
+  void RedirectFailed(const Location& loc);
+
+  // block cache, all of it is protected by mtx
+  struct Block {
+    std::vector<char> data;
+    size_t length = 0;   // short for the last block of the object
+    int rc = 0;
+  };
+  struct CacheEntry {
+    std::shared_ptr<Block> block;
+    std::shared_future<void> ready;
+    std::list<off_t>::iterator lru;
+  };
+  size_t cache_max;
+  size_t cache_block;
+  size_t cache_readahead;
+  std::map<off_t, CacheEntry> cache;
+  std::list<off_t> cache_lru;
+  off_t last_end;        // end of the previous Read, to detect sequential access
+  size_t sequential;     // number of back to back sequential reads
+  CacheEntry& Fetch(off_t block);
+  int CachedRead(char* buffer, off_t offset, size_t len);
+  void Evict(bool all = false);
+
+  // disk cache, chunks are keyed by the URL given to Open
+  HttDiskCache* disk;
+  std::atomic<bool> disk_valid;     // the validator of 'disk_key' matches the server
+  std::string disk_key;
+  HttDiskCache::Validator disk_validator;
+  void DiskValidate(const httplib::Response* resp);
+
+  // outstanding ReadAsync calls
+  std::mutex async_mtx;
+  std::condition_variable async_cv;
+  size_t async_pending;
+  // like a single range _ReadV, but served from and added to the disk cache
+  int _DiskRead(const Location& loc, const httplib::Headers& header, const std::string& key,
+		const HttDiskCache::Validator& v, char* buffer, off_t offset, size_t len, httplib::Result& result);
 };
 
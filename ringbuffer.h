@@ -3,183 +3,524 @@
 
 #include <vector>
 #include <atomic>
-#include <mutex>
-#include <condition_variable>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <cstdint>
 #include <cstring>  // For memcpy
-#define RING_BUFFER_SIZE 4*1024*1024  // Must be a power of 2
+#include <cerrno>
+#include <new>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <climits>
+#endif
+#define RING_BUFFER_SIZE 4*1024*1024  // default capacity, rounded up to a power of 2
+#define RING_CACHE_LINE 64
+#ifndef RING_FD_TABLE_SIZE
+#define RING_FD_TABLE_SIZE 16384  // highest fd number + 1 usable for rings
+#endif
+
+// **Park/unpark helpers: futex on Linux, yielding spin elsewhere**
+namespace ringpark {
+    inline void wait(std::atomic<uint32_t>& word, uint32_t expected) {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+        while (word.load(std::memory_order_acquire) == expected) {
+            std::this_thread::yield();
+        }
+#endif
+    }
 
+    inline void wake(std::atomic<uint32_t>& word) {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+    }
+}
+
+// Single-producer/single-consumer ring buffer.
+//
+// Exactly one thread may call write() and one (other) thread may call read().
+// head and tail are free-running counters living on separate cache lines; the
+// fast path of both sides is a pair of atomic loads/stores and a memcpy. A side
+// only parks on a futex when the ring is truly empty (reader) or full (writer),
+// and the opposite side only issues a wake-up syscall if somebody is parked.
+//
+// The storage is an anonymous mmap of the maximum size, so pages are only
+// backed (and zeroed) by the kernel when first touched: a 2 KB object costs one
+// page no matter how large the ring is allowed to become. If a maximum larger
+// than the initial size is given, the producer may grow() the ring; the new
+// size takes effect the next time the producer finds the ring empty, which is
+// the only moment the index->slot mapping can change without moving data.
+//
+// Optionally a notification fd (an eventfd) mirrors the reader side: it is
+// readable whenever data or EOF is pending, so a ring can be watched with
+// poll/epoll/select and drained with try_read().
 class RingBuffer {
 private:
-    std::vector<char> buffer;
-    std::atomic<size_t> head;
-    std::atomic<size_t> tail;
-    std::atomic<bool> eof_flag;  // NEW: Indicates EOF status
-    std::mutex read_mutex;
-    std::mutex write_mutex;
-    std::condition_variable not_empty;
-    std::condition_variable not_full;
-    size_t available_space;
-    size_t available_data;
+    char* buffer;
+    size_t max_capacity;
+    size_t pending_capacity;           // producer-only, applied when empty
+    std::atomic<size_t> capacity;      // written by the producer, power of 2
+
+    alignas(RING_CACHE_LINE) std::atomic<size_t> head;   // owned by the consumer
+    alignas(RING_CACHE_LINE) std::atomic<size_t> tail;   // owned by the producer
+    alignas(RING_CACHE_LINE) std::atomic<bool> eof_flag;  // Indicates EOF status
+
+    // parking words: bumped by the opposite side to wake a parked thread
+    alignas(RING_CACHE_LINE) std::atomic<uint32_t> data_seq;
+    std::atomic<uint32_t> reader_parked;
+    alignas(RING_CACHE_LINE) std::atomic<uint32_t> space_seq;
+    std::atomic<uint32_t> writer_parked;
+
+    // notification fd: signalled once per empty->non-empty transition
+    alignas(RING_CACHE_LINE) std::atomic<uint32_t> fd_signalled;
+    int notify_fd;
+
+    void signal_fd() {
+        if ((notify_fd >= 0) && !fd_signalled.load(std::memory_order_seq_cst) &&
+            !fd_signalled.exchange(1, std::memory_order_seq_cst)) {
+            uint64_t one = 1;
+            ssize_t r = ::write(notify_fd, &one, sizeof(one));
+            (void) r;
+        }
+    }
+
+    void drain_fd() {
+        uint64_t count;
+        ssize_t r = ::read(notify_fd, &count, sizeof(count));
+        (void) r;
+    }
+
+    void wake_reader() {
+        if (reader_parked.load(std::memory_order_seq_cst)) {
+            data_seq.fetch_add(1, std::memory_order_release);
+            ringpark::wake(data_seq);
+        }
+    }
+
+    void wake_writer() {
+        if (writer_parked.load(std::memory_order_seq_cst)) {
+            space_seq.fetch_add(1, std::memory_order_release);
+            ringpark::wake(space_seq);
+        }
+    }
+
+    // **Wait until at least one byte is readable or EOF is set, returns readable bytes**
+    size_t wait_data(size_t current_head) {
+        for (;;) {
+            size_t avail = tail.load(std::memory_order_acquire) - current_head;
+            if (avail || eof_flag.load(std::memory_order_acquire)) {
+                // re-read tail: the producer may have committed right before setting EOF
+                return tail.load(std::memory_order_acquire) - current_head;
+            }
+            uint32_t seq = data_seq.load(std::memory_order_acquire);
+            reader_parked.store(1, std::memory_order_seq_cst);
+            if ((tail.load(std::memory_order_seq_cst) == current_head) && !eof_flag.load(std::memory_order_seq_cst)) {
+                ringpark::wait(data_seq, seq);
+            }
+            reader_parked.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static size_t round_pow2(size_t n) {
+        size_t p = 4096;
+        while (p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    // **Producer side: switch to a pending larger capacity while nothing is buffered**
+    void apply_growth(size_t current_tail) {
+        if ((pending_capacity > capacity.load(std::memory_order_relaxed)) &&
+            (head.load(std::memory_order_seq_cst) == current_tail)) {
+            // published to the reader by the release store of the next tail
+            capacity.store(pending_capacity, std::memory_order_release);
+        }
+    }
+
+    // **Wait until at least one byte is writable or EOF is set, returns writable bytes**
+    size_t wait_space(size_t current_tail) {
+        size_t cap = capacity.load(std::memory_order_relaxed);
+        for (;;) {
+            size_t space = cap - (current_tail - head.load(std::memory_order_acquire));
+            if (space || eof_flag.load(std::memory_order_acquire)) {
+                return space;
+            }
+            uint32_t seq = space_seq.load(std::memory_order_acquire);
+            writer_parked.store(1, std::memory_order_seq_cst);
+            if ((current_tail - head.load(std::memory_order_seq_cst) == cap) && !eof_flag.load(std::memory_order_seq_cst)) {
+                ringpark::wait(space_seq, seq);
+            }
+            writer_parked.store(0, std::memory_order_relaxed);
+        }
+    }
 
 public:
-    RingBuffer() : buffer(RING_BUFFER_SIZE), head(0), tail(0), available_space(RING_BUFFER_SIZE), available_data(0), eof_flag(false) {}
+    explicit RingBuffer(size_t size = RING_BUFFER_SIZE, size_t max_size = 0)
+        : buffer(nullptr), max_capacity(round_pow2(std::max(size, max_size))),
+          pending_capacity(0), capacity(round_pow2(size)),
+          head(0), tail(0), eof_flag(false),
+          data_seq(0), reader_parked(0), space_seq(0), writer_parked(0),
+          fd_signalled(0), notify_fd(-1) {
+        void* mem = ::mmap(nullptr, max_capacity, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        buffer = static_cast<char*>(mem);
+    }
 
-    // Prevent copying
+    ~RingBuffer() {
+        ::munmap(buffer, max_capacity);
+        if (notify_fd >= 0) {
+            ::close(notify_fd);
+        }
+    }
+
+    // Prevent copying and moving: the futex words must keep their address
     RingBuffer(const RingBuffer&) = delete;
     RingBuffer& operator=(const RingBuffer&) = delete;
 
-    // Allow move semantics
-    RingBuffer(RingBuffer&& other) noexcept 
-        : buffer(std::move(other.buffer)), 
-          head(other.head.load()), 
-          tail(other.tail.load()),
-          eof_flag(other.eof_flag.load()) {}
+    // **Attach a non-blocking notification fd, the ring takes ownership and closes it**
+    void set_notify_fd(int fd) {
+        notify_fd = fd;
+        if ((tail.load(std::memory_order_seq_cst) != head.load(std::memory_order_seq_cst)) ||
+            eof_flag.load(std::memory_order_seq_cst)) {
+            signal_fd();
+        }
+    }
+
+    int get_notify_fd() const { return notify_fd; }
+
+    size_t size() const { return capacity.load(std::memory_order_acquire); }
+    // **Consumer only: bytes buffered and readable right now**
+    size_t readable() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed); }
+    size_t max_size() const { return max_capacity; }
 
-    RingBuffer& operator=(RingBuffer&& other) noexcept {
-        if (this != &other) {
-            buffer = std::move(other.buffer);
-            head.store(other.head.load());
-            tail.store(other.tail.load());
-            eof_flag.store(other.eof_flag.load());
+    // **Producer only: request a larger capacity (capped at max_size()), applied once the ring drains**
+    void grow(size_t size) {
+        size_t cap = std::min(round_pow2(size), max_capacity);
+        if (cap > pending_capacity) {
+            pending_capacity = cap;
         }
-        return *this;
     }
 
     // **Set EOF flag: Once set, readers will return 0 if no data remains**
     void set_eof() {
-        eof_flag.store(true, std::memory_order_release);
-        not_empty.notify_all();  // Wake up any waiting readers
+        eof_flag.store(true, std::memory_order_seq_cst);
+        signal_fd();
+        // Wake up any waiting reader or writer
+        data_seq.fetch_add(1, std::memory_order_release);
+        ringpark::wake(data_seq);
+        space_seq.fetch_add(1, std::memory_order_release);
+        ringpark::wake(space_seq);
     }
 
-    // **Blocking Write: Always succeeds, waits if buffer is full**
-    size_t write(const void* data, size_t len) {
-        std::unique_lock<std::mutex> lock(write_mutex);
-
-        // Wait until there is enough space
-        not_full.wait(lock, [&] { return available_space >= len || eof_flag.load(std::memory_order_acquire); });
-
-        if (eof_flag.load(std::memory_order_acquire)) {
-            return 0;  // Do not allow writes after EOF is set
+    // **Drop buffered data and clear EOF: only while no producer is running**
+    void reset() {
+        head.store(tail.load(std::memory_order_acquire), std::memory_order_seq_cst);
+        eof_flag.store(false, std::memory_order_seq_cst);
+        if ((notify_fd >= 0) && fd_signalled.exchange(0, std::memory_order_seq_cst)) {
+            drain_fd();
         }
+    }
 
+    // **Blocking Write: waits while the buffer is full, returns 0 once EOF is set**
+    size_t write(const void* data, size_t len) {
+        const char* in = static_cast<const char*>(data);
+        size_t written = 0;
         size_t current_tail = tail.load(std::memory_order_relaxed);
-        size_t first_part = std::min(len, RING_BUFFER_SIZE - current_tail);
-        size_t second_part = len - first_part;
 
-        // Copy in two parts (if wrap-around occurs)
-        memcpy(&buffer[current_tail], data, first_part);
-        if (second_part > 0) {
-            memcpy(&buffer[0], static_cast<const char*>(data) + first_part, second_part);
-        }
+        while (written < len) {
+            apply_growth(current_tail);
+            size_t space = wait_space(current_tail);
+            if (eof_flag.load(std::memory_order_acquire)) {
+                return 0;  // Do not allow writes after EOF is set
+            }
+
+            size_t cap = capacity.load(std::memory_order_relaxed);
+            size_t chunk = std::min(len - written, space);
+            size_t pos = current_tail & (cap - 1);
+            size_t first_part = std::min(chunk, cap - pos);
+            size_t second_part = chunk - first_part;
 
-        tail.store((current_tail + len) % RING_BUFFER_SIZE, std::memory_order_release);
-        available_space -= len;
-        available_data += len;
+            // Copy in two parts (if wrap-around occurs)
+            memcpy(&buffer[pos], in + written, first_part);
+            if (second_part > 0) {
+                memcpy(&buffer[0], in + written + first_part, second_part);
+            }
 
-        // Notify readers that data is available
-        not_empty.notify_one();
-	return len;
+            current_tail += chunk;
+            written += chunk;
+            tail.store(current_tail, std::memory_order_seq_cst);
+            wake_reader();
+            signal_fd();
+        }
+        return len;
     }
 
     // **Blocking Read: Returns 0 if EOF is set and no more data**
     size_t read(void* out_data, size_t len) {
-        std::unique_lock<std::mutex> lock(read_mutex);
-
-        // Wait until data is available or EOF is set
-        not_empty.wait(lock, [&] { return available_data > 0 || eof_flag.load(std::memory_order_acquire); });
+        size_t current_head = head.load(std::memory_order_relaxed);
+        size_t available = wait_data(current_head);
 
         // If EOF is set and no data left, return 0
-        if (available_data == 0 && eof_flag.load(std::memory_order_acquire)) {
+        if (!available) {
             return 0;
         }
 
-        size_t current_head = head.load(std::memory_order_relaxed);
-        size_t read_len = std::min(len, available_data);
-        size_t first_part = std::min(read_len, RING_BUFFER_SIZE - current_head);
+        size_t cap = capacity.load(std::memory_order_acquire);
+        size_t read_len = std::min(len, available);
+        size_t pos = current_head & (cap - 1);
+        size_t first_part = std::min(read_len, cap - pos);
         size_t second_part = read_len - first_part;
 
         // Copy in two parts (if wrap-around occurs)
-        memcpy(out_data, &buffer[current_head], first_part);
+        memcpy(out_data, &buffer[pos], first_part);
         if (second_part > 0) {
             memcpy(static_cast<char*>(out_data) + first_part, &buffer[0], second_part);
         }
 
-        head.store((current_head + read_len) % RING_BUFFER_SIZE, std::memory_order_release);
-        available_data -= read_len;
-        available_space += read_len;
-
-        // Notify writers that space is available
-        not_full.notify_one();
+        head.store(current_head + read_len, std::memory_order_seq_cst);
+        wake_writer();
 
         return read_len;  // Return the number of bytes actually read
     }
+
+    // **Non-blocking Read: returns -1 with errno=EAGAIN if the ring is empty, 0 on EOF**
+    // Clears the notification fd when the ring runs empty, so it can be used level-triggered.
+    ssize_t try_read(void* out_data, size_t len) {
+        size_t current_head = head.load(std::memory_order_relaxed);
+        for (;;) {
+            if ((tail.load(std::memory_order_seq_cst) != current_head) || eof_flag.load(std::memory_order_seq_cst)) {
+                return read(out_data, len);
+            }
+            if ((notify_fd < 0) || !fd_signalled.load(std::memory_order_seq_cst)) {
+                break;
+            }
+            // disarm, then re-check: a commit racing with us re-signals below
+            fd_signalled.store(0, std::memory_order_seq_cst);
+            drain_fd();
+            if ((tail.load(std::memory_order_seq_cst) != current_head) || eof_flag.load(std::memory_order_seq_cst)) {
+                signal_fd();
+            }
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+
+    // **Zero-copy Write: blocks until space is free, exposes a contiguous writable span of up to len bytes**
+    // Returns the span size, 0 once EOF is set. The data becomes visible to the reader with commit().
+    size_t reserve(char*& span, size_t len) {
+        size_t current_tail = tail.load(std::memory_order_relaxed);
+        apply_growth(current_tail);
+        size_t space = wait_space(current_tail);
+        if (eof_flag.load(std::memory_order_acquire)) {
+            span = nullptr;
+            return 0;
+        }
+        size_t cap = capacity.load(std::memory_order_relaxed);
+        size_t pos = current_tail & (cap - 1);
+        span = &buffer[pos];
+        return std::min(len, std::min(space, cap - pos));
+    }
+
+    // **Publish n bytes written into the span returned by the last reserve()**
+    void commit(size_t n) {
+        tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_seq_cst);
+        wake_reader();
+        signal_fd();
+    }
+
+    // **Zero-copy Read: blocks until data is available, exposes a contiguous readable span of up to len bytes**
+    // Returns the span size, 0 if EOF is set and no more data. Release the bytes with consume().
+    size_t peek(const char*& span, size_t len) {
+        size_t current_head = head.load(std::memory_order_relaxed);
+        size_t available = wait_data(current_head);
+        if (!available) {
+            span = nullptr;
+            return 0;
+        }
+        size_t cap = capacity.load(std::memory_order_acquire);
+        size_t pos = current_head & (cap - 1);
+        span = &buffer[pos];
+        return std::min(len, std::min(available, cap - pos));
+    }
+
+    // **Release n bytes exposed by the last peek()**
+    void consume(size_t n) {
+        head.store(head.load(std::memory_order_relaxed) + n, std::memory_order_seq_cst);
+        wake_writer();
+    }
 };
 
+// Ring buffers are addressed by the number of their notification eventfd, so
+// the handle given out is a real kernel fd which can be passed to poll/epoll.
+//
+// The fd number indexes a fixed-capacity slot table directly: lookups take no
+// lock, they only pin the slot with a per-slot user count. Every destroy()
+// bumps the slot generation, so a cached Handle to a destroyed ring (whose fd
+// number the kernel may since have reused) is detected as stale.
 class RingBufferFDManager {
+public:
+    struct Handle {
+        int fd = -1;
+        uint32_t generation = 0;
+    };
+
 private:
-    static std::unordered_map<int, std::shared_ptr<RingBuffer>> ringBuffers;
-    static std::atomic<int> fd_counter;
-    static std::mutex mutex;
+    struct alignas(RING_CACHE_LINE) Slot {
+        std::atomic<RingBuffer*> ring{nullptr};
+        std::atomic<uint32_t> generation{0};
+        std::atomic<uint32_t> users{0};
+    };
+    static Slot slots[RING_FD_TABLE_SIZE];
+
+    static RingBuffer* acquire(const Handle& h) {
+        if ((h.fd < 0) || (h.fd >= RING_FD_TABLE_SIZE)) {
+            return nullptr;
+        }
+        Slot& slot = slots[h.fd];
+        slot.users.fetch_add(1, std::memory_order_seq_cst);
+        RingBuffer* ring = slot.ring.load(std::memory_order_seq_cst);
+        if (!ring || (slot.generation.load(std::memory_order_acquire) != h.generation)) {
+            slot.users.fetch_sub(1, std::memory_order_release);
+            return nullptr;
+        }
+        return ring;
+    }
+
+    static void release(const Handle& h) {
+        slots[h.fd].users.fetch_sub(1, std::memory_order_release);
+    }
 
 public:
-    static int create() {
-        std::lock_guard<std::mutex> lock(mutex);
-        int new_fd = fd_counter.fetch_add(1, std::memory_order_relaxed);
-        ringBuffers[new_fd] = std::make_shared<RingBuffer>();  // Store shared_ptr
-        return new_fd;
-    }
-
-    static void write(int fd, const void* data, size_t len) {
-        std::shared_ptr<RingBuffer> buffer;
-
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            auto it = ringBuffers.find(fd);
-            if (it == ringBuffers.end()) {
-                std::cerr << "[Error] Invalid fd: " << fd << std::endl;
-                return;
+    // **Pins a ring for the lifetime of the object, destroy() waits for it**
+    class Pin {
+    public:
+        explicit Pin(const Handle& h) : handle(h), ring(acquire(h)) {
+            if (!ring) {
+                std::cerr << "[Error] Invalid fd: " << h.fd << std::endl;
             }
-            buffer = it->second;  // Copy shared_ptr outside the mutex
         }
-
-        buffer->write(data, len);
+        ~Pin() {
+            if (ring) {
+                release(handle);
+            }
+        }
+        Pin(const Pin&) = delete;
+        Pin& operator=(const Pin&) = delete;
+
+        explicit operator bool() const { return ring != nullptr; }
+        RingBuffer* operator->() const { return ring; }
+        RingBuffer* get() const { return ring; }
+
+    private:
+        Handle handle;
+        RingBuffer* ring;
+    };
+
+    static Handle create(size_t size = RING_BUFFER_SIZE, size_t max_size = 0) {
+        Handle h;
+#ifdef __linux__
+        int new_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+        int new_fd = -1;
+        errno = ENOSYS;
+#endif
+        if (new_fd < 0) {
+            return h;
+        }
+        if (new_fd >= RING_FD_TABLE_SIZE) {
+            ::close(new_fd);
+            errno = EMFILE;
+            return h;
+        }
+        RingBuffer* buffer;
+        try {
+            buffer = new RingBuffer(size, max_size);
+        } catch (const std::bad_alloc&) {
+            ::close(new_fd);
+            errno = ENOMEM;
+            return h;
+        }
+        buffer->set_notify_fd(new_fd);  // closed when the ring is deleted
+        Slot& slot = slots[new_fd];
+        h.fd = new_fd;
+        h.generation = slot.generation.load(std::memory_order_acquire);
+        slot.ring.store(buffer, std::memory_order_seq_cst);
+        return h;
     }
 
-    static size_t read(int fd, void* out_data, size_t len) {
-        std::shared_ptr<RingBuffer> buffer;
-
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            auto it = ringBuffers.find(fd);
-            if (it == ringBuffers.end()) {
-                std::cerr << "[Error] Invalid fd: " << fd << std::endl;
-                return 0;
-            }
-            buffer = it->second;  // Copy shared_ptr outside the mutex
+    // **Current handle of a live fd (for callers which only kept the int)**
+    static Handle handle(int fd) {
+        Handle h;
+        if ((fd >= 0) && (fd < RING_FD_TABLE_SIZE)) {
+            h.fd = fd;
+            h.generation = slots[fd].generation.load(std::memory_order_acquire);
         }
+        return h;
+    }
 
-        return buffer->read(out_data, len);
+    static void write(const Handle& h, const void* data, size_t len) {
+        Pin buffer(h);
+        if (buffer) {
+            buffer->write(data, len);
+        }
     }
 
-    static void destroy(int fd) {
-        std::lock_guard<std::mutex> lock(mutex);
-        ringBuffers.erase(fd);  // Removes shared_ptr (auto-deletes when ref count = 0)
+    static size_t read(const Handle& h, void* out_data, size_t len) {
+        Pin buffer(h);
+        return buffer ? buffer->read(out_data, len) : 0;
     }
 
-    static void set_eof(int fd) {
-        std::shared_ptr<RingBuffer> buffer;
+    static ssize_t try_read(const Handle& h, void* out_data, size_t len) {
+        Pin buffer(h);
+        if (!buffer) {
+            errno = EBADF;
+            return -1;
+        }
+        return buffer->try_read(out_data, len);
+    }
 
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            auto it = ringBuffers.find(fd);
-            if (it == ringBuffers.end()) {
-                std::cerr << "[Error] Invalid fd: " << fd << std::endl;
-                return;
-            }
-            buffer = it->second;  // Copy shared_ptr outside the mutex
+    static void set_eof(const Handle& h) {
+        Pin buffer(h);
+        if (buffer) {
+            buffer->set_eof();
         }
+    }
 
-        buffer->set_eof();
+    static void destroy(const Handle& h) {
+        if ((h.fd < 0) || (h.fd >= RING_FD_TABLE_SIZE)) {
+            return;
+        }
+        Slot& slot = slots[h.fd];
+        if (slot.generation.load(std::memory_order_acquire) != h.generation) {
+            return;  // already destroyed
+        }
+        RingBuffer* ring = slot.ring.exchange(nullptr, std::memory_order_seq_cst);
+        if (!ring) {
+            return;
+        }
+        slot.generation.fetch_add(1, std::memory_order_release);
+        // wait for pinned users to drop out before the fd number can be reused
+        while (slot.users.load(std::memory_order_seq_cst)) {
+            std::this_thread::yield();
+        }
+        delete ring;
     }
+
+    // fd based convenience wrappers
+    static void write(int fd, const void* data, size_t len) { write(handle(fd), data, len); }
+    static size_t read(int fd, void* out_data, size_t len) { return read(handle(fd), out_data, len); }
+    static ssize_t try_read(int fd, void* out_data, size_t len) { return try_read(handle(fd), out_data, len); }
+    static void set_eof(int fd) { set_eof(handle(fd)); }
+    static void destroy(int fd) { destroy(handle(fd)); }
 };